@@ -0,0 +1,154 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "bufferpool.h"
+
+#include <QPixelFormat>
+
+#include <algorithm>
+#include <bit>
+#include <new>
+#include <utility>
+
+namespace
+{
+constexpr std::size_t ALIGNMENT = 64;
+// the size class is stored in front of the buffer, the header
+// is a full alignment unit to keep the returned pointer aligned
+constexpr qsizetype HEADER_SIZE = ALIGNMENT;
+constexpr qsizetype MINIMUM_SIZE = 64 * 1024;
+// free buffers kept per size class and in total
+constexpr int MAXIMUM_FREE_PER_CLASS = 8;
+constexpr qsizetype MAXIMUM_FREE_BYTES = 256 * 1024 * 1024;
+
+void releaseImage(void *info)
+{
+    BufferPool::instance()->release(static_cast<uchar *>(info));
+}
+} // namespace
+
+BufferPool *BufferPool::instance()
+{
+    static BufferPool *p = new BufferPool();
+    return p;
+}
+
+qsizetype BufferPool::sizeClass(qsizetype size)
+{
+    if (size <= MINIMUM_SIZE) {
+        return MINIMUM_SIZE;
+    }
+    // four classes per power of two, so at most 25% of a buffer is wasted
+    const auto base = qsizetype(std::bit_floor(quint64(size)));
+    const qsizetype step = base / 4;
+    return base + (size - base + step - 1) / step * step;
+}
+
+uchar *BufferPool::acquire(qsizetype size)
+{
+    const qsizetype capacity = sizeClass(size);
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_free.find(capacity);
+        if (it != m_free.end() && !it->isEmpty()) {
+            m_freeBytes -= capacity;
+            return it->takeLast();
+        }
+    }
+
+    auto *block = static_cast<uchar *>(::operator new(capacity + HEADER_SIZE, std::align_val_t(ALIGNMENT)));
+    *reinterpret_cast<qsizetype *>(block) = capacity;
+    return block + HEADER_SIZE;
+}
+
+void BufferPool::release(uchar *buffer)
+{
+    if (buffer == nullptr) {
+        return;
+    }
+
+    uchar *block = buffer - HEADER_SIZE;
+    const qsizetype capacity = *reinterpret_cast<qsizetype *>(block);
+    {
+        QMutexLocker locker(&m_mutex);
+        auto &list = m_free[capacity];
+        if (list.size() < MAXIMUM_FREE_PER_CLASS && m_freeBytes + capacity <= MAXIMUM_FREE_BYTES) {
+            list.append(buffer);
+            m_freeBytes += capacity;
+            return;
+        }
+    }
+    ::operator delete(block, std::align_val_t(ALIGNMENT));
+}
+
+QImage BufferPool::image(const QSize &size, QImage::Format format)
+{
+    if (size.isEmpty() || format == QImage::Format_Invalid) {
+        return QImage();
+    }
+    // indexed images need a color table, let QImage handle them
+    if (format == QImage::Format_Mono || format == QImage::Format_MonoLSB || format == QImage::Format_Indexed8) {
+        return QImage(size, format);
+    }
+
+    const int depth = QImage::toPixelFormat(format).bitsPerPixel();
+    // same 32 bit aligned lines that QImage allocates itself
+    const qsizetype bytesPerLine = (qsizetype(size.width()) * depth + 31) / 32 * 4;
+    uchar *data = acquire(bytesPerLine * size.height());
+    return QImage(data, size.width(), size.height(), bytesPerLine, format, releaseImage, data);
+}
+
+PooledBuffer::PooledBuffer(qsizetype size)
+    : m_data{BufferPool::instance()->acquire(size)}
+    , m_size{size}
+{
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    BufferPool::instance()->release(m_data);
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other) noexcept
+    : m_data{std::exchange(other.m_data, nullptr)}
+    , m_size{std::exchange(other.m_size, 0)}
+{
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) noexcept
+{
+    if (this != &other) {
+        BufferPool::instance()->release(m_data);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+    }
+    return *this;
+}
+
+bool PooledBuffer::isNull() const
+{
+    return m_data == nullptr;
+}
+
+char *PooledBuffer::data()
+{
+    return reinterpret_cast<char *>(m_data);
+}
+
+qsizetype PooledBuffer::size() const
+{
+    return m_size;
+}
+
+void PooledBuffer::truncate(qsizetype size)
+{
+    m_size = std::min(size, m_size);
+}
+
+QByteArray PooledBuffer::byteArray() const
+{
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(m_data), m_size);
+}
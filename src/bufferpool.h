@@ -0,0 +1,86 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+
+/*
+ * Pool of large buffers used when decoding pages: the compressed page data
+ * and the pixels of the decoded and scaled images. Buffers are grouped in
+ * size classes and reused, so scrolling through a volume doesn't keep
+ * allocating and freeing tens of megabytes for each page.
+ */
+class BufferPool
+{
+public:
+    static BufferPool *instance();
+
+    /*
+     * Returns a buffer of at least `size` bytes, aligned to 64 bytes
+     */
+    uchar *acquire(qsizetype size);
+    void release(uchar *buffer);
+
+    /*
+     * Returns an image whose pixels are stored in a pooled buffer,
+     * the buffer goes back to the pool when the last copy of the image is destroyed
+     */
+    QImage image(const QSize &size, QImage::Format format);
+
+private:
+    BufferPool() = default;
+    ~BufferPool() = default;
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+    BufferPool(BufferPool &&) = delete;
+    BufferPool &operator=(BufferPool &&) = delete;
+
+    static qsizetype sizeClass(qsizetype size);
+
+    QMutex m_mutex;
+    // free buffers by size class
+    QHash<qsizetype, QList<uchar *>> m_free;
+    qsizetype m_freeBytes{0};
+};
+
+/*
+ * Owns a buffer from the BufferPool and gives it back when destroyed
+ */
+class PooledBuffer
+{
+public:
+    PooledBuffer() = default;
+    explicit PooledBuffer(qsizetype size);
+    ~PooledBuffer();
+    PooledBuffer(PooledBuffer &&other) noexcept;
+    PooledBuffer &operator=(PooledBuffer &&other) noexcept;
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+    bool isNull() const;
+    char *data();
+    qsizetype size() const;
+    // shrinks the used size, e.g. when less data than expected was read
+    void truncate(qsizetype size);
+
+    /*
+     * Returns a QByteArray that points to the buffer without copying it,
+     * it must not be used after the PooledBuffer is destroyed
+     */
+    QByteArray byteArray() const;
+
+private:
+    uchar *m_data{nullptr};
+    qsizetype m_size{0};
+};
+
+#endif // BUFFERPOOL_H
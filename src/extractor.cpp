@@ -235,13 +235,15 @@ QStringList Extractor::filterImages(const QStringList &files)
         u".jxl"_s, u".webp"_s, u".heif"_s, u".avif"_s
     };
     for (const auto &file : files) {
-        if (file.startsWith(u"__MACOSX"_s, Qt::CaseInsensitive) || file.startsWith(u".DS_Store"_s, Qt::CaseInsensitive)) {
+        if (file.startsWith(u"__MACOSX"_s, Qt::CaseInsensitive) || file.contains(u"/__MACOSX/"_s, Qt::CaseInsensitive)
+            || file.startsWith(u".DS_Store"_s, Qt::CaseInsensitive)) {
             continue;
         }
 
         for (const auto &extension : extensions) {
-            if (file.endsWith(extension)) {
+            if (file.endsWith(extension, Qt::CaseInsensitive)) {
                 images.append(file);
+                break;
             }
         }
     }
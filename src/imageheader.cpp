@@ -0,0 +1,492 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "imageheader.h"
+
+#include <QList>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+using ImageHeader::Info;
+using ImageHeader::Result;
+
+namespace
+{
+// larger sizes are treated as a broken header
+constexpr quint64 MAX_DIMENSION = 1 << 20;
+
+constexpr quint32 fourcc(const char (&s)[5])
+{
+    return quint32(uchar(s[0])) << 24 | quint32(uchar(s[1])) << 16 | quint32(uchar(s[2])) << 8 | quint32(uchar(s[3]));
+}
+
+Result finish(quint64 width, quint64 height, bool transposed, bool grayscale, Info *info)
+{
+    if (width == 0 || height == 0 || width > MAX_DIMENSION || height > MAX_DIMENSION) {
+        return Result::Unsupported;
+    }
+    info->size = transposed ? QSize(int(height), int(width)) : QSize(int(width), int(height));
+    info->grayscale = grayscale;
+    return Result::Ok;
+}
+
+/*
+ * Returns the orientation (1-8) stored in the first IFD of an exif block, 0 if there is none
+ */
+int exifOrientation(const uchar *p, qsizetype size)
+{
+    if (size < 14 || memcmp(p, "Exif\0\0", 6) != 0) {
+        return 0;
+    }
+    const uchar *tiff = p + 6;
+    const qsizetype tiffSize = size - 6;
+    bool littleEndian = false;
+    if (memcmp(tiff, "II", 2) == 0) {
+        littleEndian = true;
+    } else if (memcmp(tiff, "MM", 2) != 0) {
+        return 0;
+    }
+    auto read16 = [=](quint64 offset) -> quint32 {
+        return littleEndian ? qFromLittleEndian<quint16>(tiff + offset) : qFromBigEndian<quint16>(tiff + offset);
+    };
+    auto read32 = [=](quint64 offset) -> quint32 {
+        return littleEndian ? qFromLittleEndian<quint32>(tiff + offset) : qFromBigEndian<quint32>(tiff + offset);
+    };
+
+    const quint64 ifd = read32(4);
+    if (ifd < 8 || ifd + 2 > quint64(tiffSize)) {
+        return 0;
+    }
+    const quint32 count = read16(ifd);
+    for (quint32 i = 0; i < count; ++i) {
+        const quint64 entry = ifd + 2 + quint64(i) * 12;
+        if (entry + 12 > quint64(tiffSize)) {
+            break;
+        }
+        // the orientation is a single short stored in the value field
+        if (read16(entry) == 0x0112) {
+            const quint32 orientation = read16(entry + 8);
+            return orientation >= 1 && orientation <= 8 ? int(orientation) : 0;
+        }
+    }
+    return 0;
+}
+
+Result parseJpeg(const uchar *p, qsizetype size, Info *info)
+{
+    int orientation = 0;
+    qsizetype pos = 2;
+    while (true) {
+        if (pos + 4 > size) {
+            return Result::NeedMoreData;
+        }
+        if (p[pos] != 0xff) {
+            return Result::Unsupported;
+        }
+        const uchar marker = p[pos + 1];
+        // fill byte
+        if (marker == 0xff) {
+            ++pos;
+            continue;
+        }
+        // markers without a length
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8)) {
+            pos += 2;
+            continue;
+        }
+        // end of image or start of scan without a frame header
+        if (marker == 0xd9 || marker == 0xda) {
+            return Result::Unsupported;
+        }
+
+        const qsizetype length = qFromBigEndian<quint16>(p + pos + 2);
+        if (length < 2) {
+            return Result::Unsupported;
+        }
+        // SOF0-SOF15, except DHT, JPG and DAC which share the range
+        if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            if (pos + 10 > size) {
+                return Result::NeedMoreData;
+            }
+            const quint32 height = qFromBigEndian<quint16>(p + pos + 5);
+            const quint32 width = qFromBigEndian<quint16>(p + pos + 7);
+            const int components = p[pos + 9];
+            // orientations 5 to 8 rotate by 90 degrees
+            info->orientation = std::max(orientation, 1);
+            return finish(width, height, orientation >= 5, components == 1, info);
+        }
+        // APP1, exif comes before the frame header
+        if (marker == 0xe1 && orientation == 0) {
+            if (pos + 2 + length > size) {
+                return Result::NeedMoreData;
+            }
+            orientation = exifOrientation(p + pos + 4, length - 2);
+        }
+        pos += 2 + length;
+    }
+}
+
+Result parsePng(const uchar *p, qsizetype size, Info *info)
+{
+    // signature, then the IHDR chunk with width, height, bit depth and color type
+    if (size < 26) {
+        return Result::NeedMoreData;
+    }
+    if (memcmp(p + 12, "IHDR", 4) != 0) {
+        return Result::Unsupported;
+    }
+    const int colorType = p[25];
+    return finish(qFromBigEndian<quint32>(p + 16), qFromBigEndian<quint32>(p + 20), false, colorType == 0 || colorType == 4, info);
+}
+
+Result parseGif(const uchar *p, qsizetype size, Info *info)
+{
+    // logical screen descriptor
+    if (size < 10) {
+        return Result::NeedMoreData;
+    }
+    return finish(qFromLittleEndian<quint16>(p + 6), qFromLittleEndian<quint16>(p + 8), false, false, info);
+}
+
+Result parseWebp(const uchar *p, qsizetype size, Info *info)
+{
+    if (size < 30) {
+        return Result::NeedMoreData;
+    }
+    const quint32 chunk = qFromBigEndian<quint32>(p + 12);
+    if (chunk == fourcc("VP8 ")) {
+        // frame tag, start code, then 14 bit width and height
+        if (p[23] != 0x9d || p[24] != 0x01 || p[25] != 0x2a) {
+            return Result::Unsupported;
+        }
+        return finish(qFromLittleEndian<quint16>(p + 26) & 0x3fff, qFromLittleEndian<quint16>(p + 28) & 0x3fff, false, false, info);
+    }
+    if (chunk == fourcc("VP8L")) {
+        // signature, then 14 bit width - 1 and height - 1
+        if (p[20] != 0x2f) {
+            return Result::Unsupported;
+        }
+        const quint32 bits = qFromLittleEndian<quint32>(p + 21);
+        return finish((bits & 0x3fff) + 1, ((bits >> 14) & 0x3fff) + 1, false, false, info);
+    }
+    if (chunk == fourcc("VP8X")) {
+        // flags, reserved, then 24 bit canvas width - 1 and height - 1
+        const quint32 width = p[24] | p[25] << 8 | p[26] << 16;
+        const quint32 height = p[27] | p[28] << 8 | p[29] << 16;
+        return finish(width + 1, height + 1, false, false, info);
+    }
+    return Result::Unsupported;
+}
+
+/*
+ * ISO base media file format box, used by avif/heif and the jpeg xl container
+ */
+struct Box {
+    quint32 type{0};
+    qsizetype payload{0};
+    quint64 end{0};
+};
+
+// reads the header of the box at `pos`, returns false if it doesn't fit before `end`
+bool readBox(const uchar *p, qsizetype pos, quint64 end, Box *box)
+{
+    if (quint64(pos) + 8 > end) {
+        return false;
+    }
+    quint64 size = qFromBigEndian<quint32>(p + pos);
+    box->type = qFromBigEndian<quint32>(p + pos + 4);
+    box->payload = pos + 8;
+    if (size == 1) {
+        if (quint64(pos) + 16 > end) {
+            return false;
+        }
+        size = qFromBigEndian<quint64>(p + pos + 8);
+        box->payload = pos + 16;
+    } else if (size == 0) {
+        // extends to the end of the parent
+        size = end - pos;
+    }
+    // sizes that would overflow are broken
+    if (size < quint64(box->payload - pos) || size > (quint64(1) << 48)) {
+        return false;
+    }
+    box->end = pos + size;
+    return true;
+}
+
+bool isHeifBrand(quint32 brand)
+{
+    return brand == fourcc("avif") || brand == fourcc("avis") || brand == fourcc("heic") || brand == fourcc("heix") || brand == fourcc("mif1")
+        || brand == fourcc("msf1");
+}
+
+/*
+ * The size of an avif/heif image is stored in the ispe property of its primary item,
+ * properties are listed in ipco and assigned to items in ipma
+ */
+Result parseHeifMeta(const uchar *p, qsizetype begin, qsizetype end, Info *info)
+{
+    bool hasPrimaryItem = false;
+    quint32 primaryItem = 0;
+    QList<Box> properties;
+    QList<Box> associations;
+
+    // meta is a full box, skip version and flags
+    Box box;
+    for (qsizetype pos = begin + 4; readBox(p, pos, end, &box) && box.end <= quint64(end); pos = box.end) {
+        if (box.type == fourcc("pitm") && box.payload + 6 <= qsizetype(box.end)) {
+            const bool version0 = p[box.payload] == 0;
+            if (version0 || box.payload + 8 <= qsizetype(box.end)) {
+                primaryItem = version0 ? qFromBigEndian<quint16>(p + box.payload + 4) : qFromBigEndian<quint32>(p + box.payload + 4);
+                hasPrimaryItem = true;
+            }
+        } else if (box.type == fourcc("iprp")) {
+            Box child;
+            for (qsizetype c = box.payload; readBox(p, c, box.end, &child) && child.end <= box.end; c = child.end) {
+                if (child.type == fourcc("ipco")) {
+                    Box property;
+                    for (qsizetype i = child.payload; readBox(p, i, child.end, &property) && property.end <= child.end; i = property.end) {
+                        properties.append(property);
+                    }
+                } else if (child.type == fourcc("ipma")) {
+                    associations.append(child);
+                }
+            }
+        }
+    }
+
+    // 1-based indexes of the properties of the primary item
+    QList<int> primaryProperties;
+    for (const Box &ipma : std::as_const(associations)) {
+        const qsizetype ipmaEnd = qsizetype(ipma.end);
+        if (ipma.payload + 8 > ipmaEnd) {
+            continue;
+        }
+        const int version = p[ipma.payload];
+        const bool wideIndexes = p[ipma.payload + 3] & 1;
+        const quint32 count = qFromBigEndian<quint32>(p + ipma.payload + 4);
+        qsizetype pos = ipma.payload + 8;
+        for (quint32 i = 0; i < count; ++i) {
+            const int idSize = version < 1 ? 2 : 4;
+            if (pos + idSize + 1 > ipmaEnd) {
+                break;
+            }
+            const quint32 item = version < 1 ? qFromBigEndian<quint16>(p + pos) : qFromBigEndian<quint32>(p + pos);
+            const int associationCount = p[pos + idSize];
+            pos += idSize + 1;
+            for (int a = 0; a < associationCount; ++a) {
+                if (pos + (wideIndexes ? 2 : 1) > ipmaEnd) {
+                    break;
+                }
+                // the highest bit marks essential properties
+                const int index = wideIndexes ? qFromBigEndian<quint16>(p + pos) & 0x7fff : p[pos] & 0x7f;
+                pos += wideIndexes ? 2 : 1;
+                if (hasPrimaryItem && item == primaryItem) {
+                    primaryProperties.append(index);
+                }
+            }
+        }
+    }
+
+    quint64 width = 0;
+    quint64 height = 0;
+    bool transposed = false;
+    bool grayscale = false;
+    for (int i = 0; i < properties.size(); ++i) {
+        const Box &property = properties.at(i);
+        const qsizetype propertyEnd = qsizetype(property.end);
+        if (!primaryProperties.isEmpty() && !primaryProperties.contains(i + 1)) {
+            continue;
+        }
+        if (property.type == fourcc("ispe") && property.payload + 12 <= propertyEnd) {
+            const quint32 w = qFromBigEndian<quint32>(p + property.payload + 4);
+            const quint32 h = qFromBigEndian<quint32>(p + property.payload + 8);
+            // without item associations use the largest image, the others are thumbnails
+            if (quint64(w) * h > width * height) {
+                width = w;
+                height = h;
+            }
+        } else if (property.type == fourcc("irot") && property.payload + 1 <= propertyEnd) {
+            // counter-clockwise rotation in steps of 90 degrees
+            transposed = (p[property.payload] & 3) % 2 == 1;
+        } else if (property.type == fourcc("pixi") && property.payload + 5 <= propertyEnd) {
+            grayscale = p[property.payload + 4] == 1;
+        }
+    }
+    return finish(width, height, transposed, grayscale, info);
+}
+
+Result parseHeif(const uchar *p, qsizetype size, Info *info)
+{
+    Box box;
+    if (!readBox(p, 0, size, &box) || box.end > quint64(size)) {
+        return Result::NeedMoreData;
+    }
+    // major brand, minor version, then the compatible brands
+    bool heif = box.end >= 16 && isHeifBrand(qFromBigEndian<quint32>(p + 8));
+    for (qsizetype pos = 16; !heif && pos + 4 <= qsizetype(box.end); pos += 4) {
+        heif = isHeifBrand(qFromBigEndian<quint32>(p + pos));
+    }
+    if (!heif) {
+        return Result::Unsupported;
+    }
+
+    qsizetype pos = box.end;
+    while (true) {
+        if (!readBox(p, pos, size, &box)) {
+            return Result::NeedMoreData;
+        }
+        if (box.type == fourcc("meta")) {
+            if (box.end > quint64(size)) {
+                return Result::NeedMoreData;
+            }
+            return parseHeifMeta(p, box.payload, qsizetype(box.end), info);
+        }
+        // the image data comes first, not worth reading all of it to get to the metadata
+        if (box.type == fourcc("mdat") || box.end > quint64(size)) {
+            return Result::Unsupported;
+        }
+        pos = box.end;
+    }
+}
+
+/*
+ * Reads the least significant bits first, as jpeg xl stores them
+ */
+class BitReader
+{
+public:
+    BitReader(const uchar *data, qsizetype size)
+        : m_data{data}
+        , m_size{size * 8}
+    {
+    }
+
+    quint32 read(int count)
+    {
+        quint32 value = 0;
+        for (int i = 0; i < count; ++i) {
+            if (m_pos >= m_size) {
+                m_overflow = true;
+                return 0;
+            }
+            value |= quint32((m_data[m_pos / 8] >> (m_pos % 8)) & 1) << i;
+            ++m_pos;
+        }
+        return value;
+    }
+
+    bool overflow() const
+    {
+        return m_overflow;
+    }
+
+private:
+    const uchar *m_data;
+    qsizetype m_size;
+    qsizetype m_pos{0};
+    bool m_overflow{false};
+};
+
+Result parseJxlCodestream(const uchar *p, qsizetype size, Info *info)
+{
+    if (size < 2 || p[0] != 0xff || p[1] != 0x0a) {
+        return size < 2 ? Result::NeedMoreData : Result::Unsupported;
+    }
+
+    // the signature is followed by the size header and the image metadata
+    BitReader bits(p + 2, size - 2);
+    auto readDimension = [&bits]() -> quint64 {
+        static constexpr int bitCounts[] = {9, 13, 18, 30};
+        const quint32 selector = bits.read(2);
+        return 1 + bits.read(bitCounts[selector]);
+    };
+
+    const bool small = bits.read(1);
+    const quint64 height = small ? 8 * (1 + bits.read(5)) : readDimension();
+    const quint32 ratio = bits.read(3);
+    quint64 width = 0;
+    if (ratio == 0) {
+        width = small ? 8 * (1 + bits.read(5)) : readDimension();
+    } else {
+        static constexpr quint32 ratios[8][2] = {{1, 1}, {1, 1}, {12, 10}, {4, 3}, {3, 2}, {16, 9}, {5, 4}, {2, 1}};
+        width = height * ratios[ratio][0] / ratios[ratio][1];
+    }
+
+    // all_default and extra_fields flags, the orientation is the first extra field
+    int orientation = 1;
+    if (!bits.read(1) && bits.read(1)) {
+        orientation = 1 + int(bits.read(3));
+    }
+    if (bits.overflow()) {
+        return Result::NeedMoreData;
+    }
+    // same values as exif, 5 to 8 rotate by 90 degrees
+    return finish(width, height, orientation > 4, false, info);
+}
+
+Result parseJxlContainer(const uchar *p, qsizetype size, Info *info)
+{
+    // skip the signature box
+    qsizetype pos = 12;
+    Box box;
+    while (true) {
+        if (!readBox(p, pos, size, &box)) {
+            return Result::NeedMoreData;
+        }
+        if (box.type == fourcc("jxlc")) {
+            return parseJxlCodestream(p + box.payload, size - box.payload, info);
+        }
+        // partial codestream, starts with a 4 byte index
+        if (box.type == fourcc("jxlp")) {
+            if (box.payload + 4 > size) {
+                return Result::NeedMoreData;
+            }
+            const qsizetype end = std::min<quint64>(box.end, size);
+            return parseJxlCodestream(p + box.payload + 4, end - box.payload - 4, info);
+        }
+        if (box.end > quint64(size)) {
+            return Result::NeedMoreData;
+        }
+        pos = box.end;
+    }
+}
+} // namespace
+
+Result ImageHeader::parse(QByteArrayView data, Info *info)
+{
+    const auto *p = reinterpret_cast<const uchar *>(data.data());
+    const qsizetype size = data.size();
+    if (size < 12) {
+        return Result::NeedMoreData;
+    }
+
+    if (p[0] == 0xff && p[1] == 0xd8) {
+        return parseJpeg(p, size, info);
+    }
+    if (memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0) {
+        return parsePng(p, size, info);
+    }
+    if (memcmp(p, "GIF87a", 6) == 0 || memcmp(p, "GIF89a", 6) == 0) {
+        return parseGif(p, size, info);
+    }
+    if (memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WEBP", 4) == 0) {
+        return parseWebp(p, size, info);
+    }
+    if (memcmp(p + 4, "ftyp", 4) == 0) {
+        return parseHeif(p, size, info);
+    }
+    if (p[0] == 0xff && p[1] == 0x0a) {
+        return parseJxlCodestream(p, size, info);
+    }
+    if (memcmp(p, "\0\0\0\x0cJXL \r\n\x87\n", 12) == 0) {
+        return parseJxlContainer(p, size, info);
+    }
+    return Result::Unsupported;
+}
@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef IMAGEHEADER_H
+#define IMAGEHEADER_H
+
+#include <QByteArrayView>
+#include <QSize>
+
+/*
+ * Reads the size of an image from the first bytes of the file,
+ * without creating an image reader for each page. Supports jpeg, png,
+ * gif, webp, avif/heif and jpeg xl, other formats are left to QImageReader.
+ */
+namespace ImageHeader
+{
+struct Info {
+    // size of the image as shown, rotated according to its orientation
+    QSize size;
+    bool grayscale{false};
+    // exif orientation of jpeg images, 1 when the image is stored upright
+    int orientation{1};
+};
+
+enum class Result {
+    Ok,
+    // the header continues past the end of the data, try again with more data
+    NeedMoreData,
+    // unknown format or broken header
+    Unsupported,
+};
+
+Result parse(QByteArrayView data, Info *info);
+}
+
+#endif // IMAGEHEADER_H
@@ -0,0 +1,634 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "imagescaler.h"
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCALER_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SCALER_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// weights are 16 bit fixed point numbers so that the simd kernels can
+// multiply and add pairs of pixels with a single instruction
+constexpr int PRECISION_BITS = 14;
+constexpr int ROUNDING = 1 << (PRECISION_BITS - 1);
+
+struct Coefficients {
+    int inSize{0};
+    // number of weights per output pixel, a multiple of 8 so that
+    // the simd kernels can always load a full vector of weights
+    int taps{0};
+    // first input pixel used by each output pixel
+    std::vector<int> first;
+    // number of input pixels used by each output pixel
+    std::vector<int> count;
+    std::vector<qint16> weights;
+};
+
+double sinc(double x)
+{
+    if (x == 0.0) {
+        return 1.0;
+    }
+    x *= std::numbers::pi;
+    return std::sin(x) / x;
+}
+
+double lanczos3(double x)
+{
+    if (x > -3.0 && x < 3.0) {
+        return sinc(x) * sinc(x / 3.0);
+    }
+    return 0.0;
+}
+
+double box(double x)
+{
+    if (x > -0.5 && x <= 0.5) {
+        return 1.0;
+    }
+    return 0.0;
+}
+
+Coefficients computeCoefficients(int inSize, int outSize, ImageScaler::Filter filter)
+{
+    const auto filterFunction = filter == ImageScaler::Filter::Area ? box : lanczos3;
+    const double filterSupport = filter == ImageScaler::Filter::Area ? 0.5 : 3.0;
+    const double scale = double(inSize) / outSize;
+    // when downscaling the filter is stretched to cover all input pixels
+    const double filterScale = std::max(scale, 1.0);
+    const double support = filterSupport * filterScale;
+
+    Coefficients c;
+    c.inSize = inSize;
+    c.taps = (int(std::ceil(support)) * 2 + 1 + 7) & ~7;
+    c.first.resize(outSize);
+    c.count.resize(outSize);
+    c.weights.assign(std::size_t(outSize) * c.taps, 0);
+
+    std::vector<double> w(c.taps);
+    for (int i = 0; i < outSize; ++i) {
+        const double center = (i + 0.5) * scale;
+        const int xmin = std::max(0, int(center - support + 0.5));
+        const int xmax = std::min(inSize, int(center + support + 0.5));
+        const int n = std::min(xmax - xmin, c.taps);
+        qint16 *k = &c.weights[std::size_t(i) * c.taps];
+
+        double sum = 0.0;
+        for (int x = 0; x < n; ++x) {
+            w[x] = filterFunction((x + xmin - center + 0.5) / filterScale);
+            sum += w[x];
+        }
+        if (n <= 0 || sum == 0.0) {
+            c.first[i] = std::clamp(int(center), 0, inSize - 1);
+            c.count[i] = 1;
+            k[0] = 1 << PRECISION_BITS;
+            continue;
+        }
+
+        // make the rounded weights add up to exactly 1.0,
+        // otherwise flat areas get slightly darker or brighter
+        int fixedSum = 0;
+        int largest = 0;
+        for (int x = 0; x < n; ++x) {
+            k[x] = std::lround(w[x] / sum * (1 << PRECISION_BITS));
+            fixedSum += k[x];
+            if (k[x] > k[largest]) {
+                largest = x;
+            }
+        }
+        k[largest] += (1 << PRECISION_BITS) - fixedSum;
+        c.first[i] = xmin;
+        c.count[i] = n;
+    }
+
+    return c;
+}
+
+inline uchar clip(int value)
+{
+    value >>= PRECISION_BITS;
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/*
+ * Generic kernels
+ */
+void horizontal4Generic(const uchar *src, uchar *dst, const Coefficients &c)
+{
+    for (std::size_t i = 0; i < c.first.size(); ++i) {
+        const uchar *s = src + c.first[i] * 4;
+        const qint16 *k = &c.weights[i * c.taps];
+        int c0 = ROUNDING;
+        int c1 = ROUNDING;
+        int c2 = ROUNDING;
+        int c3 = ROUNDING;
+        for (int x = 0; x < c.count[i]; ++x) {
+            c0 += s[x * 4] * k[x];
+            c1 += s[x * 4 + 1] * k[x];
+            c2 += s[x * 4 + 2] * k[x];
+            c3 += s[x * 4 + 3] * k[x];
+        }
+        dst[i * 4] = clip(c0);
+        dst[i * 4 + 1] = clip(c1);
+        dst[i * 4 + 2] = clip(c2);
+        dst[i * 4 + 3] = clip(c3);
+    }
+}
+
+void horizontal1Generic(const uchar *src, uchar *dst, const Coefficients &c)
+{
+    for (std::size_t i = 0; i < c.first.size(); ++i) {
+        const uchar *s = src + c.first[i];
+        const qint16 *k = &c.weights[i * c.taps];
+        int value = ROUNDING;
+        for (int x = 0; x < c.count[i]; ++x) {
+            value += s[x] * k[x];
+        }
+        dst[i] = clip(value);
+    }
+}
+
+void verticalGeneric(const uchar *src, qsizetype stride, int first, int count, const qint16 *k, uchar *dst, int bytes)
+{
+    const uchar *rows = src + qsizetype(first) * stride;
+    // accumulate in blocks so that the rows are read sequentially
+    constexpr int blockSize = 256;
+    int acc[blockSize];
+    for (int x0 = 0; x0 < bytes; x0 += blockSize) {
+        const int n = std::min(blockSize, bytes - x0);
+        std::fill_n(acc, n, ROUNDING);
+        for (int y = 0; y < count; ++y) {
+            const uchar *row = rows + y * stride + x0;
+            for (int x = 0; x < n; ++x) {
+                acc[x] += row[x] * k[y];
+            }
+        }
+        for (int x = 0; x < n; ++x) {
+            dst[x0 + x] = clip(acc[x]);
+        }
+    }
+}
+
+#if defined(SCALER_X86)
+/*
+ * x86 kernels
+ */
+inline int packWeights(qint16 low, qint16 high)
+{
+    return int(quint32(quint16(low)) | (quint32(quint16(high)) << 16));
+}
+
+// adds four rgba pixels multiplied by their weights to acc
+__attribute__((target("sse4.1"))) inline __m128i accumulate4Sse41(__m128i acc, const uchar *s, const qint16 *k)
+{
+    // pairs of pixels as 16 bit r0 r1 g0 g1 b0 b1 a0 a1, ready for madd
+    const __m128i lowShuffle = _mm_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+    const __m128i highShuffle = _mm_setr_epi8(8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, -1);
+    const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+    const __m128i weights = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(pixels, lowShuffle), _mm_shuffle_epi32(weights, 0x00)));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_shuffle_epi8(pixels, highShuffle), _mm_shuffle_epi32(weights, 0x55)));
+    return acc;
+}
+
+// adds one rgba pixel multiplied by its weight to acc
+__attribute__((target("sse4.1"))) inline __m128i accumulate1Sse41(__m128i acc, const uchar *s, qint16 k)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3, -1, -1, -1);
+    int pixel;
+    memcpy(&pixel, s, 4);
+    const __m128i pixels = _mm_shuffle_epi8(_mm_cvtsi32_si128(pixel), shuffle);
+    return _mm_add_epi32(acc, _mm_madd_epi16(pixels, _mm_set1_epi32(quint16(k))));
+}
+
+__attribute__((target("sse4.1"))) inline void store4Sse41(uchar *dst, __m128i acc)
+{
+    acc = _mm_srai_epi32(acc, PRECISION_BITS);
+    acc = _mm_packs_epi32(acc, acc);
+    acc = _mm_packus_epi16(acc, acc);
+    const int result = _mm_cvtsi128_si32(acc);
+    memcpy(dst, &result, 4);
+}
+
+// number of pixels that can be read with full vectors without reading
+// past the end of the line, the weights are padded with zeroes
+inline int vectorCount4(const Coefficients &c, std::size_t i)
+{
+    return std::min((c.count[i] + 3) & ~3, (c.inSize - c.first[i]) & ~3);
+}
+
+__attribute__((target("sse4.1"))) void horizontal4Sse41(const uchar *src, uchar *dst, const Coefficients &c)
+{
+    for (std::size_t i = 0; i < c.first.size(); ++i) {
+        const uchar *s = src + c.first[i] * 4;
+        const qint16 *k = &c.weights[i * c.taps];
+        const int vectorCount = vectorCount4(c, i);
+        __m128i acc = _mm_set1_epi32(ROUNDING);
+        int x = 0;
+        for (; x < vectorCount; x += 4) {
+            acc = accumulate4Sse41(acc, s + x * 4, k + x);
+        }
+        for (; x < c.count[i]; ++x) {
+            acc = accumulate1Sse41(acc, s + x * 4, k[x]);
+        }
+        store4Sse41(dst + i * 4, acc);
+    }
+}
+
+__attribute__((target("sse4.1"))) void horizontal1Sse41(const uchar *src, uchar *dst, const Coefficients &c)
+{
+    for (std::size_t i = 0; i < c.first.size(); ++i) {
+        const int first = c.first[i];
+        const int count = c.count[i];
+        const int paddedCount = (count + 7) & ~7;
+        const qint16 *k = &c.weights[i * c.taps];
+        // near the right edge a full vector would read past the end of the line
+        if (first + paddedCount > c.inSize) {
+            int value = ROUNDING;
+            for (int x = 0; x < count; ++x) {
+                value += src[first + x] * k[x];
+            }
+            dst[i] = clip(value);
+            continue;
+        }
+
+        const uchar *s = src + first;
+        __m128i acc = _mm_setzero_si128();
+        for (int x = 0; x < paddedCount; x += 8) {
+            const __m128i pixels = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(s + x)));
+            const __m128i weights = _mm_loadu_si128(reinterpret_cast<const __m128i *>(k + x));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(pixels, weights));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+        dst[i] = clip(_mm_cvtsi128_si32(acc) + ROUNDING);
+    }
+}
+
+__attribute__((target("sse4.1"))) void
+verticalSse41(const uchar *src, qsizetype stride, int first, int count, const qint16 *k, uchar *dst, int bytes)
+{
+    const uchar *rows = src + qsizetype(first) * stride;
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 16 <= bytes; x += 16) {
+        __m128i s0 = _mm_set1_epi32(ROUNDING);
+        __m128i s1 = s0;
+        __m128i s2 = s0;
+        __m128i s3 = s0;
+        int y = 0;
+        // interleave two rows so that madd multiplies and adds both of them
+        for (; y + 2 <= count; y += 2) {
+            const __m128i weights = _mm_set1_epi32(packWeights(k[y], k[y + 1]));
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows + y * stride + x));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows + (y + 1) * stride + x));
+            const __m128i aLow = _mm_unpacklo_epi8(a, zero);
+            const __m128i aHigh = _mm_unpackhi_epi8(a, zero);
+            const __m128i bLow = _mm_unpacklo_epi8(b, zero);
+            const __m128i bHigh = _mm_unpackhi_epi8(b, zero);
+            s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(aLow, bLow), weights));
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(aLow, bLow), weights));
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi16(aHigh, bHigh), weights));
+            s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi16(aHigh, bHigh), weights));
+        }
+        if (y < count) {
+            const __m128i weights = _mm_set1_epi32(packWeights(k[y], 0));
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows + y * stride + x));
+            const __m128i aLow = _mm_unpacklo_epi8(a, zero);
+            const __m128i aHigh = _mm_unpackhi_epi8(a, zero);
+            s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(aLow, zero), weights));
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(aLow, zero), weights));
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi16(aHigh, zero), weights));
+            s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi16(aHigh, zero), weights));
+        }
+        s0 = _mm_srai_epi32(s0, PRECISION_BITS);
+        s1 = _mm_srai_epi32(s1, PRECISION_BITS);
+        s2 = _mm_srai_epi32(s2, PRECISION_BITS);
+        s3 = _mm_srai_epi32(s3, PRECISION_BITS);
+        const __m128i result = _mm_packus_epi16(_mm_packs_epi32(s0, s1), _mm_packs_epi32(s2, s3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), result);
+    }
+
+    for (; x < bytes; ++x) {
+        int value = ROUNDING;
+        for (int y = 0; y < count; ++y) {
+            value += rows[y * stride + x] * k[y];
+        }
+        dst[x] = clip(value);
+    }
+}
+
+__attribute__((target("avx2"))) void horizontal4Avx2(const uchar *src, uchar *dst, const Coefficients &c)
+{
+    // same as accumulate4Sse41 but with eight pixels, four in each 128 bit lane
+    const __m256i lowShuffle = _mm256_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1, //
+                                                0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+    const __m256i highShuffle = _mm256_setr_epi8(8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, -1, //
+                                                 8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, -1);
+    // the weight pairs matching the pixels picked by the shuffles
+    const __m256i lowWeights = _mm256_setr_epi32(0, 0, 0, 0, 2, 2, 2, 2);
+    const __m256i highWeights = _mm256_setr_epi32(1, 1, 1, 1, 3, 3, 3, 3);
+
+    for (std::size_t i = 0; i < c.first.size(); ++i) {
+        const uchar *s = src + c.first[i] * 4;
+        const qint16 *k = &c.weights[i * c.taps];
+        const int vectorCount = vectorCount4(c, i);
+        __m256i acc8 = _mm256_setzero_si256();
+        int x = 0;
+        for (; x + 8 <= vectorCount; x += 8) {
+            const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + x * 4));
+            const __m256i weights = _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(k + x)));
+            acc8 = _mm256_add_epi32(acc8, _mm256_madd_epi16(_mm256_shuffle_epi8(pixels, lowShuffle), _mm256_permutevar8x32_epi32(weights, lowWeights)));
+            acc8 = _mm256_add_epi32(acc8, _mm256_madd_epi16(_mm256_shuffle_epi8(pixels, highShuffle), _mm256_permutevar8x32_epi32(weights, highWeights)));
+        }
+        __m128i acc = _mm_add_epi32(_mm256_castsi256_si128(acc8), _mm256_extracti128_si256(acc8, 1));
+        acc = _mm_add_epi32(acc, _mm_set1_epi32(ROUNDING));
+        for (; x < vectorCount; x += 4) {
+            acc = accumulate4Sse41(acc, s + x * 4, k + x);
+        }
+        for (; x < c.count[i]; ++x) {
+            acc = accumulate1Sse41(acc, s + x * 4, k[x]);
+        }
+        store4Sse41(dst + i * 4, acc);
+    }
+}
+
+__attribute__((target("avx2"))) void
+verticalAvx2(const uchar *src, qsizetype stride, int first, int count, const qint16 *k, uchar *dst, int bytes)
+{
+    const uchar *rows = src + qsizetype(first) * stride;
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    // unpack and pack work inside 128 bit lanes, doing both keeps the byte order
+    for (; x + 32 <= bytes; x += 32) {
+        __m256i s0 = _mm256_set1_epi32(ROUNDING);
+        __m256i s1 = s0;
+        __m256i s2 = s0;
+        __m256i s3 = s0;
+        int y = 0;
+        for (; y + 2 <= count; y += 2) {
+            const __m256i weights = _mm256_set1_epi32(packWeights(k[y], k[y + 1]));
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows + y * stride + x));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows + (y + 1) * stride + x));
+            const __m256i aLow = _mm256_unpacklo_epi8(a, zero);
+            const __m256i aHigh = _mm256_unpackhi_epi8(a, zero);
+            const __m256i bLow = _mm256_unpacklo_epi8(b, zero);
+            const __m256i bHigh = _mm256_unpackhi_epi8(b, zero);
+            s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi16(aLow, bLow), weights));
+            s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi16(aLow, bLow), weights));
+            s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi16(aHigh, bHigh), weights));
+            s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi16(aHigh, bHigh), weights));
+        }
+        if (y < count) {
+            const __m256i weights = _mm256_set1_epi32(packWeights(k[y], 0));
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows + y * stride + x));
+            const __m256i aLow = _mm256_unpacklo_epi8(a, zero);
+            const __m256i aHigh = _mm256_unpackhi_epi8(a, zero);
+            s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi16(aLow, zero), weights));
+            s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi16(aLow, zero), weights));
+            s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi16(aHigh, zero), weights));
+            s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi16(aHigh, zero), weights));
+        }
+        s0 = _mm256_srai_epi32(s0, PRECISION_BITS);
+        s1 = _mm256_srai_epi32(s1, PRECISION_BITS);
+        s2 = _mm256_srai_epi32(s2, PRECISION_BITS);
+        s3 = _mm256_srai_epi32(s3, PRECISION_BITS);
+        const __m256i result = _mm256_packus_epi16(_mm256_packs_epi32(s0, s1), _mm256_packs_epi32(s2, s3));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), result);
+    }
+
+    if (x < bytes) {
+        verticalSse41(src + x, stride, first, count, k, dst + x, bytes - x);
+    }
+}
+#endif // SCALER_X86
+
+#if defined(SCALER_NEON)
+/*
+ * arm kernels
+ */
+inline int horizontalSum(int32x4_t v)
+{
+#if defined(__aarch64__)
+    return vaddvq_s32(v);
+#else
+    const int32x2_t sum = vadd_s32(vget_low_s32(v), vget_high_s32(v));
+    return vget_lane_s32(vpadd_s32(sum, sum), 0);
+#endif
+}
+
+void horizontal4Neon(const uchar *src, uchar *dst, const Coefficients &c)
+{
+    for (std::size_t i = 0; i < c.first.size(); ++i) {
+        const uchar *s = src + c.first[i] * 4;
+        const qint16 *k = &c.weights[i * c.taps];
+        int32x4_t acc = vdupq_n_s32(ROUNDING);
+        for (int x = 0; x < c.count[i]; ++x) {
+            quint32 pixel;
+            memcpy(&pixel, s + x * 4, 4);
+            const int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(pixel))));
+            acc = vmlal_n_s16(acc, vget_low_s16(pixels), k[x]);
+        }
+        const int16x4_t narrowed = vqshrn_n_s32(acc, PRECISION_BITS);
+        const uint8x8_t result = vqmovun_s16(vcombine_s16(narrowed, narrowed));
+        const quint32 pixel = vget_lane_u32(vreinterpret_u32_u8(result), 0);
+        memcpy(dst + i * 4, &pixel, 4);
+    }
+}
+
+void horizontal1Neon(const uchar *src, uchar *dst, const Coefficients &c)
+{
+    for (std::size_t i = 0; i < c.first.size(); ++i) {
+        const int first = c.first[i];
+        const int count = c.count[i];
+        const int paddedCount = (count + 7) & ~7;
+        const qint16 *k = &c.weights[i * c.taps];
+        if (first + paddedCount > c.inSize) {
+            int value = ROUNDING;
+            for (int x = 0; x < count; ++x) {
+                value += src[first + x] * k[x];
+            }
+            dst[i] = clip(value);
+            continue;
+        }
+
+        const uchar *s = src + first;
+        int32x4_t acc = vdupq_n_s32(0);
+        for (int x = 0; x < paddedCount; x += 8) {
+            const int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(s + x)));
+            const int16x8_t weights = vld1q_s16(k + x);
+            acc = vmlal_s16(acc, vget_low_s16(pixels), vget_low_s16(weights));
+            acc = vmlal_s16(acc, vget_high_s16(pixels), vget_high_s16(weights));
+        }
+        dst[i] = clip(horizontalSum(acc) + ROUNDING);
+    }
+}
+
+void verticalNeon(const uchar *src, qsizetype stride, int first, int count, const qint16 *k, uchar *dst, int bytes)
+{
+    const uchar *rows = src + qsizetype(first) * stride;
+    int x = 0;
+    for (; x + 8 <= bytes; x += 8) {
+        int32x4_t low = vdupq_n_s32(ROUNDING);
+        int32x4_t high = low;
+        for (int y = 0; y < count; ++y) {
+            const int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(rows + y * stride + x)));
+            low = vmlal_n_s16(low, vget_low_s16(pixels), k[y]);
+            high = vmlal_n_s16(high, vget_high_s16(pixels), k[y]);
+        }
+        const int16x8_t narrowed = vcombine_s16(vqshrn_n_s32(low, PRECISION_BITS), vqshrn_n_s32(high, PRECISION_BITS));
+        vst1_u8(dst + x, vqmovun_s16(narrowed));
+    }
+
+    for (; x < bytes; ++x) {
+        int value = ROUNDING;
+        for (int y = 0; y < count; ++y) {
+            value += rows[y * stride + x] * k[y];
+        }
+        dst[x] = clip(value);
+    }
+}
+#endif // SCALER_NEON
+
+struct Kernels {
+    const char *name;
+    void (*horizontal4)(const uchar *src, uchar *dst, const Coefficients &c);
+    void (*horizontal1)(const uchar *src, uchar *dst, const Coefficients &c);
+    void (*vertical)(const uchar *src, qsizetype stride, int first, int count, const qint16 *k, uchar *dst, int bytes);
+};
+
+const Kernels &kernels()
+{
+    static const Kernels k = []() {
+#if defined(SCALER_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernels{"AVX2", horizontal4Avx2, horizontal1Sse41, verticalAvx2};
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return Kernels{"SSE4.1", horizontal4Sse41, horizontal1Sse41, verticalSse41};
+        }
+#elif defined(SCALER_NEON)
+        return Kernels{"NEON", horizontal4Neon, horizontal1Neon, verticalNeon};
+#endif
+        return Kernels{"generic", horizontal4Generic, horizontal1Generic, verticalGeneric};
+    }();
+    return k;
+}
+
+/*
+ * Converts the image to one of the formats the kernels work with:
+ * Grayscale8 (1 byte per pixel) or a 4 bytes per pixel format
+ */
+QImage normalized(const QImage &image)
+{
+    switch (image.format()) {
+    case QImage::Format_Grayscale8:
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_RGBX8888:
+        return image;
+    case QImage::Format_Mono:
+    case QImage::Format_MonoLSB:
+    case QImage::Format_Indexed8:
+    case QImage::Format_Grayscale16:
+        if (image.isGrayscale()) {
+            return image.convertToFormat(QImage::Format_Grayscale8);
+        }
+        break;
+    default:
+        break;
+    }
+    // filtering has to be done on premultiplied pixels to not bleed
+    // the color of transparent pixels into the visible ones
+    return image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+}
+
+/*
+ * The negative lobes of the lanczos filter can overshoot a color
+ * past the alpha value, which is not a valid premultiplied pixel
+ */
+void fixPremultiplied(QImage &image)
+{
+    for (int y = 0; y < image.height(); ++y) {
+        auto *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            const int a = qAlpha(line[x]);
+            if (a == 255) {
+                continue;
+            }
+            line[x] = qRgba(std::min(qRed(line[x]), a), std::min(qGreen(line[x]), a), std::min(qBlue(line[x]), a), a);
+        }
+    }
+}
+} // namespace
+
+QImage ImageScaler::scaled(const QImage &image, const QSize &size, Filter filter)
+{
+    if (image.isNull() || size.isEmpty()) {
+        return QImage();
+    }
+
+    const QImage src = normalized(image);
+    if (src.size() == size) {
+        return src;
+    }
+
+    const Kernels &k = kernels();
+    const int bytesPerPixel = src.format() == QImage::Format_Grayscale8 ? 1 : 4;
+
+    QImage horizontal = src;
+    if (src.width() != size.width()) {
+        const Coefficients c = computeCoefficients(src.width(), size.width(), filter);
+        horizontal = BufferPool::instance()->image(QSize(size.width(), src.height()), src.format());
+        if (horizontal.isNull()) {
+            return QImage();
+        }
+        const auto pass = bytesPerPixel == 1 ? k.horizontal1 : k.horizontal4;
+        for (int y = 0; y < src.height(); ++y) {
+            pass(src.constScanLine(y), horizontal.scanLine(y), c);
+        }
+    }
+
+    QImage result = horizontal;
+    if (src.height() != size.height()) {
+        const Coefficients c = computeCoefficients(src.height(), size.height(), filter);
+        result = BufferPool::instance()->image(size, src.format());
+        if (result.isNull()) {
+            return QImage();
+        }
+        const uchar *bits = horizontal.constBits();
+        const qsizetype stride = horizontal.bytesPerLine();
+        for (int y = 0; y < size.height(); ++y) {
+            k.vertical(bits, stride, c.first[y], c.count[y], &c.weights[std::size_t(y) * c.taps], result.scanLine(y), size.width() * bytesPerPixel);
+        }
+    }
+
+    if (filter == Filter::Lanczos3 && result.format() == QImage::Format_ARGB32_Premultiplied) {
+        fixPremultiplied(result);
+    }
+    result.setColorSpace(src.colorSpace());
+
+    return result;
+}
+
+const char *ImageScaler::instructionSet()
+{
+    return kernels().name;
+}
@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef IMAGESCALER_H
+#define IMAGESCALER_H
+
+#include <QImage>
+
+/*
+ * Separable resampler used to scale pages to the view size.
+ * Compared to Qt::SmoothTransformation it is faster, keeps screentones
+ * and line art sharp and has a Grayscale8 path that works on one channel.
+ * The inner loops have AVX2, SSE4.1 and NEON versions, the best one
+ * supported by the cpu is picked at runtime.
+ */
+namespace ImageScaler
+{
+enum class Filter {
+    // box filter, averages the covered pixels
+    Area,
+    Lanczos3,
+};
+
+/*
+ * Scales the image to exactly `size`. Images with an alpha channel are
+ * returned premultiplied, Grayscale8 images stay Grayscale8.
+ */
+QImage scaled(const QImage &image, const QSize &size, Filter filter = Filter::Lanczos3);
+
+/*
+ * Name of the instruction set used by the resampler, for debugging
+ */
+const char *instructionSet();
+}
+
+#endif // IMAGESCALER_H
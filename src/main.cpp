@@ -5,20 +5,58 @@
  */
 
 #include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
 #include <QGuiApplication>
 #include <QIcon>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
 #include <QQmlPropertyMap>
 #include <QQuickStyle>
+#include <QQuickWindow>
 
 #include "mangaimageprovider.h"
+#include "mangaloader.h"
+#include "perfstats.h"
+#include "repacker.h"
+
+namespace
+{
+void addOptions(QCommandLineParser *parser)
+{
+    parser->addOption(QCommandLineOption(QStringLiteral("repack"),
+                                         QStringLiteral("Convert the given volumes into uncompressed cbz files with a page index, then exit.")));
+    parser->addOption(QCommandLineOption(QStringLiteral("output"),
+                                         QStringLiteral("Folder where the repacked volumes are written, the current folder by default."),
+                                         QStringLiteral("folder"),
+                                         QDir::currentPath()));
+}
+
+// batch mode doesn't need a display, it runs without the gui
+int repack(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setOrganizationName(QStringLiteral("georgefb"));
+    app.setApplicationName(QStringLiteral("rakki"));
+
+    QCommandLineParser clParser;
+    addOptions(&clParser);
+    clParser.process(app);
+    return Repacker::run(clParser.positionalArguments(), clParser.value(QStringLiteral("output")));
+}
+} // namespace
 
 int main(int argc, char *argv[])
 {
     auto startTime = QDateTime::currentMSecsSinceEpoch();
     qSetMessagePattern(QStringLiteral("%{time [hh:mm:ss.zzz]}: %{message}"));
 
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--repack") == 0 || qstrcmp(argv[i], "-repack") == 0) {
+            return repack(argc, argv);
+        }
+    }
+
     QGuiApplication::setDesktopFileName(QStringLiteral("com.georgefb.rakki"));
 
     QGuiApplication app(argc, argv);
@@ -27,12 +65,18 @@ int main(int argc, char *argv[])
     QGuiApplication::setWindowIcon(QIcon::fromTheme(QStringLiteral("rakki")));
 
     QCommandLineParser clParser;
+    addOptions(&clParser);
     clParser.process(app);
     QString file;
     if (clParser.positionalArguments().size() > 0) {
         file = clParser.positionalArguments().first();
     }
 
+    // open the volume while the qml engine is loading, MangaImagesModel::setPath converts the path the same way
+    if (!file.isEmpty()) {
+        MangaLoader::instance()->preload(QUrl::fromUserInput(file).toLocalFile(), startTime);
+    }
+
     QQmlApplicationEngine engine(&app);
     const QUrl url(QStringLiteral("qrc:/qt/qml/com/georgefb/rakki/qml/main.qml"));
     auto onObjectCreated = [url](const QObject *obj, const QUrl &objUrl) {
@@ -48,6 +92,9 @@ int main(int argc, char *argv[])
     engine.rootContext()->setContextProperty(QStringLiteral("ctxFile"), file);
 
     engine.load(url);
+    if (auto *window = qobject_cast<QQuickWindow *>(engine.rootObjects().value(0))) {
+        PerfStats::instance()->watchWindow(window);
+    }
 
     qDebug() << "execution time:" << QDateTime::currentMSecsSinceEpoch() - startTime;
 
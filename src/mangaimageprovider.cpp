@@ -5,10 +5,9 @@
  */
 
 #include "mangaimageprovider.h"
-#include "mangaloader.h"
+#include "pagedecoder.h"
 
-#include <KArchive>
-#include <QImageReader>
+#include <QUrl>
 
 MangaImageProvider::MangaImageProvider()
 {
@@ -27,18 +26,7 @@ MangaResponse::MangaResponse(const QString &id, const QSize &requestedSize)
 
 void MangaResponse::getPreview(const QString &id, const QSize &requestedSize)
 {
-    KArchive *archive = MangaLoader::instance()->archive();
-    QImageReader imageReader;
-    if (archive == nullptr) {
-        imageReader.setFileName(id);
-    } else {
-        auto file = archive->directory()->file(id);
-        if (file == nullptr) {
-            return;
-        }
-        imageReader.setDevice(file->createDevice());
-    }
-    m_image = imageReader.read().scaled(requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    m_image = PageDecoder::decode(id, requestedSize);
     Q_EMIT finished();
 }
 
@@ -24,6 +24,22 @@ MangaImagesModel::MangaImagesModel(QObject *parent)
         endInsertRows();
         Q_EMIT updated();
     });
+    connect(MangaLoader::instance(), &MangaLoader::imageSizesChanged, this, [=, this](QList<Image> images) {
+        // sizes only change within a volume, a new volume resets the model through imagesReady
+        if (images.count() != m_images.count()) {
+            qWarning() << "page sizes changed for" << images.count() << "pages, the model has" << m_images.count();
+            return;
+        }
+        Q_EMIT sizesAboutToChange();
+        for (int i = 0; i < images.count(); ++i) {
+            const bool sizeChanged = images.at(i).size != m_images.at(i).size;
+            m_images[i] = images.at(i);
+            if (sizeChanged) {
+                Q_EMIT dataChanged(index(i), index(i), {WidthRole, HeightRole});
+            }
+        }
+        Q_EMIT sizesChanged();
+    });
 }
 
 int MangaImagesModel::rowCount(const QModelIndex &parent) const
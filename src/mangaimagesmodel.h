@@ -15,6 +15,10 @@
 struct Image {
     QString path;
     QSize size;
+    // identical pages have the same non zero content hash
+    quint64 contentHash{0};
+    // color pages are decoded as grayscale when this is set
+    bool grayscale{false};
 };
 
 class MangaImagesModel : public QAbstractListModel
@@ -48,6 +52,9 @@ public:
 Q_SIGNALS:
     void updated();
     void pathChanged();
+    // around size updates of pages probed in the background, the view keeps what it shows in place
+    void sizesAboutToChange();
+    void sizesChanged();
 
 private:
     QList<Image> m_images;
@@ -7,11 +7,37 @@
 #include "mangaloader.h"
 
 #include <QCollator>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
 #include <QDirIterator>
 #include <QFileInfo>
 #include <QImageReader>
+#include <QSettings>
+#include <QThread>
+
+#include <KZipFileEntry>
+
+#include <algorithm>
+#include <utility>
 
 #include "extractor.h"
+#include "imageheader.h"
+#include "pagedecoder.h"
+#include "pagehashindex.h"
+#include "perfstats.h"
+
+using namespace Qt::StringLiterals;
+
+namespace
+{
+// probed right away when a volume is reopened at a saved page
+constexpr int PAGES_PROBED_BEFORE = 2;
+constexpr int PAGES_PROBED_AFTER = 4;
+// the other pages are probed in the background, the model is updated after each batch
+constexpr int PROBE_BATCH_SIZE = 16;
+}
 
 MangaLoader::MangaLoader()
     : QObject()
@@ -25,9 +51,27 @@ MangaLoader::MangaLoader()
     });
     connect(m_extractor, &Extractor::finished, this, [=, this]() {
         setExtractionProgress(0);
-        handlePath(m_extractor->extractionFolder());
+        // keep the id of the extracted archive instead of the temporary folder
+        const QString folder = m_extractor->extractionFolder();
+        {
+            QMutexLocker locker(&m_archiveMutex);
+            m_pagesFolder = folder;
+        }
+        setupImages(dirImages(folder, true));
     });
     connect(m_extractor, &Extractor::finishedMemory, this, &MangaLoader::setupImages);
+    connect(this, &MangaLoader::imagesReady, this, [this]() {
+        if (m_openTimer.isValid()) {
+            PerfStats::instance()->addOpenPhase(u"pages probed"_s, m_openTimer.elapsed());
+            m_openTimer.invalidate();
+        }
+    });
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &MangaLoader::stopThreads);
+}
+
+MangaLoader::~MangaLoader()
+{
+    stopThreads();
 }
 
 MangaLoader *MangaLoader::instance()
@@ -36,59 +80,444 @@ MangaLoader *MangaLoader::instance()
     return l;
 }
 
+void MangaLoader::setSource(KArchive *archive, const QString &indexedFile, const QList<RepackIndex::Page> &indexedPages)
+{
+    QMutexLocker locker(&m_archiveMutex);
+    delete m_archive;
+    m_archive = archive;
+    m_indexedFile = indexedFile;
+    m_indexedPages.clear();
+    for (const auto &page : indexedPages) {
+        m_indexedPages.insert(page.name, page);
+    }
+}
+
 void MangaLoader::setupImages(const QStringList &images, KArchive *archive)
 {
     setExtractionProgress(0);
+    stopProbing();
     m_images.clear();
-    delete m_archive;
-    m_archive = archive;
+    m_startPage = QImage();
+    setSource(archive);
+
+    // the image provider could be reading from the archive at the same time
+    const ProbedImages probed = probeVolume(images, archive, m_sourceId, m_pagesFolder, &m_archiveMutex);
+    m_images = probed.images;
+    m_startIndex = probed.startIndex;
+    ++m_generation;
+    Q_EMIT imagesReady(m_images);
+    startProbing(probed.estimatedImages);
+}
 
+void MangaLoader::setupIndexedImages(const QString &file, const QList<RepackIndex::Page> &pages)
+{
+    setExtractionProgress(0);
+    stopProbing();
+    m_startPage = QImage();
+    setSource(nullptr, file, pages);
+
+    m_images = indexedImages(pages, m_sourceId);
+    m_startIndex = savedIndex(m_images, m_sourceId);
+    ++m_generation;
+    Q_EMIT imagesReady(m_images);
+}
+
+MangaLoader::ProbedImages
+MangaLoader::probeVolume(const QStringList &entries, KArchive *archive, const QString &sourceId, const QString &pagesFolder, QMutex *archiveMutex)
+{
+    const QString savedPath = QSettings().value(readingPositionKey(sourceId)).toString();
+    const int savedEntry = savedPath.isEmpty() ? -1 : entries.indexOf(savedPath);
+    if (savedEntry <= 0) {
+        return {probeImages(entries, archive, sourceId, pagesFolder, archiveMutex), 0, {}};
+    }
+
+    // enough pages to fill the window around the saved one, the view is kept in place
+    // while the pages above it get their real size, see main.qml
+    const int first = std::max(savedEntry - PAGES_PROBED_BEFORE, 0);
+    const int last = std::min<int>(savedEntry + PAGES_PROBED_AFTER, entries.count() - 1);
+    const QList<Image> probedImages = probeImages(entries.mid(first, last - first + 1), archive, sourceId, pagesFolder, archiveMutex);
+    if (probedImages.isEmpty()) {
+        return {probeImages(entries, archive, sourceId, pagesFolder, archiveMutex), 0, {}};
+    }
+    QHash<QString, Image> probedEntries;
+    for (const Image &image : probedImages) {
+        probedEntries.insert(image.path, image);
+    }
+    const auto savedImage = probedEntries.constFind(savedPath);
+    const QSize estimatedSize = savedImage != probedEntries.cend() ? savedImage->size : probedImages.first().size;
+
+    ProbedImages probed;
+    PageHashIndex *hashIndex = PageHashIndex::instance();
+    const bool skipFillerPages = hashIndex->skipFillerPages();
+    for (int i = 0; i < entries.count(); ++i) {
+        if (i >= first && i <= last) {
+            // unreadable and filler pages are already left out
+            const auto it = probedEntries.constFind(entries.at(i));
+            if (it != probedEntries.cend()) {
+                if (i <= savedEntry) {
+                    probed.startIndex = probed.images.count();
+                }
+                probed.images.append(*it);
+            }
+            continue;
+        }
+        const PageHashes hashes = hashIndex->hashes(sourceId, makePageKey(sourceId, pagesFolder, archive != nullptr, entries.at(i)));
+        if (skipFillerPages && hashIndex->isFiller(sourceId, hashes.perceptual)) {
+            continue;
+        }
+        probed.estimatedImages.append(probed.images.count());
+        probed.images.append({entries.at(i), estimatedSize, hashes.content, false});
+    }
+
+    // the pages right after the saved one are the next to be read
+    std::stable_sort(probed.estimatedImages.begin(), probed.estimatedImages.end(), [&probed](int a, int b) {
+        const int distanceA = a > probed.startIndex ? a - probed.startIndex : (probed.startIndex - a) * 2;
+        const int distanceB = b > probed.startIndex ? b - probed.startIndex : (probed.startIndex - b) * 2;
+        return distanceA < distanceB;
+    });
+    return probed;
+}
+
+void MangaLoader::startProbing(const QList<int> &estimatedImages)
+{
+    if (estimatedImages.isEmpty()) {
+        return;
+    }
+
+    const QList<Image> images = m_images;
+    const int generation = m_generation;
+    KArchive *archive = m_archive;
+    const QString sourceId = m_sourceId;
+    const QString pagesFolder = m_pagesFolder;
+    m_stopProbing = false;
+    m_probeThread = QThread::create([this, images, estimatedImages, generation, archive, sourceId, pagesFolder]() {
+        for (qsizetype i = 0; i < estimatedImages.count() && !m_stopProbing; i += PROBE_BATCH_SIZE) {
+            const QList<int> batch = estimatedImages.mid(i, PROBE_BATCH_SIZE);
+            QStringList entries;
+            for (int index : batch) {
+                entries.append(images.at(index).path);
+            }
+            QHash<QString, Image> probedEntries;
+            for (const Image &image : probeImages(entries, archive, sourceId, pagesFolder, &m_archiveMutex)) {
+                probedEntries.insert(image.path, image);
+            }
+
+            QMetaObject::invokeMethod(
+                this,
+                [this, batch, probedEntries, generation]() {
+                    if (generation != m_generation) {
+                        return;
+                    }
+                    // pages that can't be read keep the estimated size
+                    for (int index : batch) {
+                        const auto it = probedEntries.constFind(m_images.at(index).path);
+                        if (it != probedEntries.cend()) {
+                            m_images[index] = *it;
+                        }
+                    }
+                    Q_EMIT imageSizesChanged(m_images);
+                },
+                Qt::QueuedConnection);
+        }
+    });
+    m_probeThread->start();
+}
+
+void MangaLoader::stopProbing()
+{
+    if (m_probeThread == nullptr) {
+        return;
+    }
+    // the archive is deleted once a new volume is set, at most one batch has to finish
+    m_stopProbing = true;
+    m_probeThread->wait();
+    delete m_probeThread;
+    m_probeThread = nullptr;
+}
+
+void MangaLoader::stopThreads()
+{
+    stopProbing();
+    m_preloadPendingPath.clear();
+    if (m_preloadThread != nullptr) {
+        m_preloadThread->wait();
+        delete m_preloadThread;
+        m_preloadThread = nullptr;
+    }
+    if (m_preloadedVolume) {
+        delete m_preloadedVolume->archive;
+        m_preloadedVolume.reset();
+    }
+}
+
+QString MangaLoader::readingPositionKey(const QString &sourceId)
+{
+    const QByteArray hash = QCryptographicHash::hash(sourceId.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return u"ReadingPositions/"_s + QString::fromLatin1(hash);
+}
+
+int MangaLoader::savedIndex(const QList<Image> &images, const QString &sourceId)
+{
+    const QString savedPath = QSettings().value(readingPositionKey(sourceId)).toString();
+    if (savedPath.isEmpty()) {
+        return 0;
+    }
+    const auto it = std::find_if(images.cbegin(), images.cend(), [&savedPath](const Image &image) {
+        return image.path == savedPath;
+    });
+    return it != images.cend() ? int(std::distance(images.cbegin(), it)) : 0;
+}
+
+void MangaLoader::saveReadingPosition(int index)
+{
+    if (index < 0 || index >= m_images.count()) {
+        return;
+    }
+    // the page is saved rather than the index, the index changes when filler pages are skipped
+    QSettings().setValue(readingPositionKey(m_sourceId), m_images.at(index).path);
+}
+
+QList<Image> MangaLoader::indexedImages(const QList<RepackIndex::Page> &pages, const QString &sourceId)
+{
+    QList<Image> images;
+    images.reserve(pages.count());
+    PageHashIndex *hashIndex = PageHashIndex::instance();
+    const bool skipFillerPages = hashIndex->skipFillerPages();
+    for (const auto &page : pages) {
+        if (skipFillerPages) {
+            const PageHashes hashes = hashIndex->hashes(sourceId, makePageKey(sourceId, QString(), true, page.name));
+            if (hashIndex->isFiller(sourceId, hashes.perceptual)) {
+                continue;
+            }
+        }
+        // same content hash as for other zip entries
+        const quint64 contentHash = (quint64(page.crc32) << 32) | quint32(page.length);
+        images.append({page.name, page.size, contentHash, page.grayscale});
+    }
+    return images;
+}
+
+QList<Image> MangaLoader::probeImages(const QStringList &entries, KArchive *archive, const QString &sourceId, const QString &pagesFolder, QMutex *archiveMutex)
+{
+    QList<Image> images;
     std::unique_ptr<QIODevice> dev;
     QFileInfo fi;
     QImageReader imageReader;
     imageReader.setAutoTransform(true);
-    for (int i = 0; i < images.count(); ++i) {
-        fi.setFile(images.at(i));
-        if (archive != nullptr) {
-            const KArchiveFile *entry = archive->directory()->file(images.at(i));
+    PageHashIndex *hashIndex = PageHashIndex::instance();
+    const bool skipFillerPages = hashIndex->skipFillerPages();
+    for (int i = 0; i < entries.count(); ++i) {
+        const PageHashes hashes = hashIndex->hashes(sourceId, makePageKey(sourceId, pagesFolder, archive != nullptr, entries.at(i)));
+        if (skipFillerPages && hashIndex->isFiller(sourceId, hashes.perceptual)) {
+            continue;
+        }
+        quint64 contentHash = hashes.content;
 
-            imageReader.setFormat(fi.suffix().toUtf8());
+        QMutexLocker locker(archiveMutex);
+        const KArchiveFile *entry = nullptr;
+        if (archive != nullptr) {
+            entry = archive->directory()->file(entries.at(i));
             if (!entry) {
                 continue;
             }
-            dev.reset(entry->createDevice());
-        } else {
-            std::unique_ptr<QFile> file(new QFile(images.at(i)));
-            if (!file->open(QIODevice::ReadOnly)) {
-                continue;
+            // zip archives store a crc of each file, no need to wait for the page to be decoded
+            if (auto zipEntry = dynamic_cast<const KZipFileEntry *>(entry)) {
+                contentHash = (quint64(zipEntry->crc32()) << 32) | quint32(zipEntry->size());
             }
-            dev.reset(file.release());
         }
+        auto openDevice = [&]() -> QIODevice * {
+            if (entry != nullptr) {
+                return entry->createDevice();
+            }
+            auto file = std::make_unique<QFile>(entries.at(i));
+            if (!file->open(QIODevice::ReadOnly)) {
+                return nullptr;
+            }
+            return file.release();
+        };
 
+        dev.reset(openDevice());
         if (dev.get() == nullptr) {
             continue;
         }
 
-        imageReader.setDevice(dev.get());
-        if (!imageReader.canRead()) {
-            continue;
-        }
-
-        QSize pageSize = imageReader.size();
-        if (imageReader.transformation() & QImageIOHandler::TransformationRotate90) {
-            pageSize.transpose();
-        }
+        const ImageHeader::Info header = headerInfo(dev.get());
+        QSize pageSize = header.size;
         if (!pageSize.isValid()) {
-            const QImage i = imageReader.read();
-            if (!i.isNull()) {
-                pageSize = i.size();
+            // unknown format, the device has to start from the beginning again
+            dev.reset(openDevice());
+            if (dev.get() == nullptr) {
+                continue;
+            }
+            fi.setFile(entries.at(i));
+            imageReader.setFormat(archive != nullptr ? fi.suffix().toUtf8() : QByteArray());
+            imageReader.setDevice(dev.get());
+            if (!imageReader.canRead()) {
+                continue;
+            }
+
+            pageSize = imageReader.size();
+            if (imageReader.transformation() & QImageIOHandler::TransformationRotate90) {
+                pageSize.transpose();
+            }
+            if (!pageSize.isValid()) {
+                const QImage i = imageReader.read();
+                if (!i.isNull()) {
+                    pageSize = i.size();
+                }
             }
         }
         if (pageSize.isValid()) {
-            m_images.append({images.at(i), pageSize});
+            images.append({entries.at(i), pageSize, contentHash, header.grayscale});
         }
     }
+    return images;
+}
+
+ImageHeader::Info MangaLoader::headerInfo(QIODevice *device)
+{
+    // the header is usually in the first few KiB, deflated entries only inflate what is read
+    constexpr qsizetype initialSize = 4 * 1024;
+    constexpr qsizetype maximumSize = 256 * 1024;
+    QByteArray data;
+    qsizetype wanted = initialSize;
+    while (true) {
+        const QByteArray chunk = device->read(wanted - data.size());
+        data.append(chunk);
+
+        ImageHeader::Info info;
+        const ImageHeader::Result result = ImageHeader::parse(data, &info);
+        if (result == ImageHeader::Result::Ok) {
+            return info;
+        }
+        if (result == ImageHeader::Result::Unsupported || data.size() < wanted || wanted >= maximumSize) {
+            return ImageHeader::Info();
+        }
+        wanted *= 4;
+    }
+}
+
+void MangaLoader::preload(const QString &path, qint64 startTime)
+{
+    if (path.isEmpty() || m_preloadThread != nullptr) {
+        return;
+    }
+    m_startTime = startTime;
+    m_preloadThread = QThread::create([this, path]() {
+        m_preloadedVolume = openVolume(path);
+    });
+    // queued, the volume is handed over on the gui thread
+    connect(m_preloadThread, &QThread::finished, this, &MangaLoader::onPreloadFinished);
+    m_preloadThread->start();
+}
+
+void MangaLoader::onPreloadFinished()
+{
+    // already cleaned up by stopThreads()
+    if (m_preloadThread == nullptr) {
+        return;
+    }
+    m_preloadThread->wait();
+    delete m_preloadThread;
+    m_preloadThread = nullptr;
+    // otherwise the volume is kept until handlePath() is called
+    if (!m_preloadPendingPath.isEmpty()) {
+        handlePath(std::exchange(m_preloadPendingPath, QString()));
+    }
+}
+
+std::unique_ptr<MangaLoader::Volume> MangaLoader::openVolume(const QString &path)
+{
+    QFileInfo fileInfo(path);
+    if (!fileInfo.exists()) {
+        return nullptr;
+    }
+
+    auto volume = std::make_unique<Volume>();
+    volume->path = path;
+    volume->sourceId = makeSourceId(fileInfo);
+    volume->skipFillerPages = PageHashIndex::instance()->skipFillerPages();
+    if (fileInfo.isDir()) {
+        volume->pagesFolder = fileInfo.absoluteFilePath();
+        volume->entries = dirImages(volume->pagesFolder, true);
+    } else if (const auto pages = RepackIndex::read(fileInfo.absoluteFilePath()); !pages.isEmpty()) {
+        volume->indexedFile = fileInfo.absoluteFilePath();
+        volume->indexedPages = pages;
+    } else {
+        // rar archives are extracted by unrar, they are opened the usual way
+        Extractor extractor;
+        if (!extractor.open(fileInfo.absoluteFilePath())) {
+            return nullptr;
+        }
+        connect(&extractor, &Extractor::finishedMemory, &extractor, [&volume](const QStringList &entries, KArchive *archive) {
+            volume->entries = entries;
+            volume->archive = archive;
+        });
+        extractor.extractArchive();
+        if (volume->archive == nullptr) {
+            return nullptr;
+        }
+    }
+    PerfStats::instance()->addOpenPhase(u"volume opened"_s, QDateTime::currentMSecsSinceEpoch() - m_startTime);
+
+    if (volume->indexedFile.isEmpty()) {
+        const ProbedImages probed = probeVolume(volume->entries, volume->archive, volume->sourceId, volume->pagesFolder, nullptr);
+        volume->images = probed.images;
+        volume->startIndex = probed.startIndex;
+        volume->estimatedImages = probed.estimatedImages;
+    } else {
+        volume->images = indexedImages(volume->indexedPages, volume->sourceId);
+        volume->startIndex = savedIndex(volume->images, volume->sourceId);
+    }
+    PerfStats::instance()->addOpenPhase(u"pages probed"_s, QDateTime::currentMSecsSinceEpoch() - m_startTime);
+
+    // decoded at full resolution, the size it's shown at isn't known until the window exists
+    if (!volume->images.isEmpty()) {
+        const QString startPath = volume->images.at(volume->startIndex).path;
+        PooledBuffer data;
+        if (volume->indexedFile.isEmpty()) {
+            data = readPage(volume->archive, startPath);
+        } else {
+            const auto it = std::find_if(volume->indexedPages.cbegin(), volume->indexedPages.cend(), [&startPath](const RepackIndex::Page &page) {
+                return page.name == startPath;
+            });
+            data = RepackIndex::readPage(volume->indexedFile, *it);
+        }
+        if (!data.isNull()) {
+            volume->startPage = PageDecoder::decode(data.byteArray());
+        }
+        PerfStats::instance()->addOpenPhase(u"start page decoded"_s, QDateTime::currentMSecsSinceEpoch() - m_startTime);
+    }
+
+    return volume;
+}
+
+void MangaLoader::usePreloadedVolume(Volume &volume)
+{
+    setExtractionProgress(0);
+    {
+        QMutexLocker locker(&m_archiveMutex);
+        m_sourceId = volume.sourceId;
+        m_pagesFolder = volume.pagesFolder;
+    }
+    // the filler setting is only known once main.qml is loaded, probe again if it changed
+    if (volume.skipFillerPages != PageHashIndex::instance()->skipFillerPages()) {
+        if (volume.indexedFile.isEmpty()) {
+            setupImages(volume.entries, volume.archive);
+        } else {
+            setupIndexedImages(volume.indexedFile, volume.indexedPages);
+        }
+        return;
+    }
+
+    stopProbing();
+    setSource(volume.archive, volume.indexedFile, volume.indexedPages);
+    m_images = volume.images;
+    m_startIndex = volume.startIndex;
+    m_startPage = volume.startPage;
+    ++m_generation;
     Q_EMIT imagesReady(m_images);
+    startProbing(volume.estimatedImages);
 }
 
 void MangaLoader::handlePath(const QString &path)
@@ -97,11 +526,38 @@ void MangaLoader::handlePath(const QString &path)
         return;
     }
 
+    if (m_preloadThread != nullptr) {
+        // waiting for it is still faster than starting over, without blocking the event loop
+        m_preloadPendingPath = path;
+        return;
+    }
+    if (m_preloadedVolume) {
+        std::unique_ptr<Volume> volume = std::move(m_preloadedVolume);
+        if (volume->path == path) {
+            PerfStats::instance()->addOpenPhase(u"volume shown"_s, QDateTime::currentMSecsSinceEpoch() - m_startTime);
+            usePreloadedVolume(*volume);
+            return;
+        }
+        delete volume->archive;
+    }
+
+    PerfStats::instance()->resetOpenPhases();
+    m_openTimer.start();
+
     QFileInfo fileInfo(path);
+    {
+        QMutexLocker locker(&m_archiveMutex);
+        m_sourceId = makeSourceId(fileInfo);
+        if (fileInfo.isDir()) {
+            m_pagesFolder = fileInfo.absoluteFilePath();
+        }
+    }
 
     if (fileInfo.isDir()) {
         QStringList images = dirImages(fileInfo.absoluteFilePath(), true);
         setupImages(images);
+    } else if (const auto pages = RepackIndex::read(fileInfo.absoluteFilePath()); !pages.isEmpty()) {
+        setupIndexedImages(fileInfo.absoluteFilePath(), pages);
     } else {
         m_extractor->open(fileInfo.absoluteFilePath());
         m_extractor->extractArchive();
@@ -144,6 +600,127 @@ KArchive *MangaLoader::archive() const
     return m_archive;
 }
 
+QList<Image> MangaLoader::images() const
+{
+    return m_images;
+}
+
+int MangaLoader::generation() const
+{
+    return m_generation;
+}
+
+QString MangaLoader::sourceId() const
+{
+    QMutexLocker locker(&m_archiveMutex);
+    return m_sourceId;
+}
+
+QString MangaLoader::pageKey(const QString &path) const
+{
+    QMutexLocker locker(&m_archiveMutex);
+    return makePageKey(m_sourceId, m_pagesFolder, m_archive != nullptr || !m_indexedFile.isEmpty(), path);
+}
+
+QString MangaLoader::makePageKey(const QString &sourceId, const QString &pagesFolder, bool inArchive, const QString &path)
+{
+    if (inArchive) {
+        return sourceId + u"/"_s + path;
+    }
+
+    QFileInfo fi(path);
+    return u"%1/%2|%3|%4"_s.arg(sourceId, QDir(pagesFolder).relativeFilePath(path))
+        .arg(fi.size())
+        .arg(fi.lastModified().toMSecsSinceEpoch());
+}
+
+QImage MangaLoader::takeStartPage()
+{
+    return std::exchange(m_startPage, QImage());
+}
+
+int MangaLoader::startIndex() const
+{
+    return m_startIndex;
+}
+
+PooledBuffer MangaLoader::readPage(const QString &path)
+{
+    QElapsedTimer timer;
+    timer.start();
+    PooledBuffer data = readSourcePage(path);
+    // includes waiting for other threads, that's the throughput decoding gets
+    if (!data.isNull()) {
+        PerfStats::instance()->addArchiveRead(data.size(), timer.nsecsElapsed());
+    }
+    return data;
+}
+
+PooledBuffer MangaLoader::readSourcePage(const QString &path)
+{
+    QMutexLocker locker(&m_archiveMutex);
+    if (!m_indexedFile.isEmpty()) {
+        // plain reads at a known offset, several threads can read at once
+        const QString file = m_indexedFile;
+        const RepackIndex::Page page = m_indexedPages.value(path);
+        locker.unlock();
+        return RepackIndex::readPage(file, page);
+    }
+    if (m_archive == nullptr) {
+        locker.unlock();
+        return readPage(nullptr, path);
+    }
+    return readPage(m_archive, path);
+}
+
+PooledBuffer MangaLoader::readPage(KArchive *archive, const QString &path)
+{
+    std::unique_ptr<QIODevice> dev;
+    qint64 size = 0;
+    if (archive != nullptr) {
+        const KArchiveFile *entry = archive->directory()->file(path);
+        if (entry == nullptr) {
+            return PooledBuffer();
+        }
+        size = entry->size();
+        dev.reset(entry->createDevice());
+    } else {
+        auto file = std::make_unique<QFile>(path);
+        if (!file->open(QIODevice::ReadOnly)) {
+            return PooledBuffer();
+        }
+        size = file->size();
+        dev = std::move(file);
+    }
+    if (dev == nullptr) {
+        return PooledBuffer();
+    }
+
+    PooledBuffer buffer(size);
+    qint64 bytesRead = 0;
+    while (bytesRead < size) {
+        const qint64 n = dev->read(buffer.data() + bytesRead, size - bytesRead);
+        if (n <= 0) {
+            break;
+        }
+        bytesRead += n;
+    }
+    if (bytesRead == 0) {
+        return PooledBuffer();
+    }
+    buffer.truncate(bytesRead);
+
+    return buffer;
+}
+
+QString MangaLoader::makeSourceId(const QFileInfo &fileInfo)
+{
+    if (fileInfo.isDir()) {
+        return fileInfo.absoluteFilePath();
+    }
+    return u"%1|%2|%3"_s.arg(fileInfo.absoluteFilePath()).arg(fileInfo.size()).arg(fileInfo.lastModified().toMSecsSinceEpoch());
+}
+
 int MangaLoader::extractionProgress()
 {
     return m_extractionProgress;
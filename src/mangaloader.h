@@ -7,12 +7,25 @@
 #ifndef MANGALOADER_H
 #define MANGALOADER_H
 
+#include "bufferpool.h"
+#include "imageheader.h"
 #include "mangaimagesmodel.h"
+#include "repackindex.h"
 
+#include <QElapsedTimer>
+#include <QHash>
+#include <QImage>
 #include <QMimeDatabase>
+#include <QMutex>
 #include <QObject>
 
+#include <atomic>
+#include <memory>
+
 class KArchive;
+class QFileInfo;
+class QIODevice;
+class QThread;
 class QQmlEngine;
 class QJSEngine;
 class Extractor;
@@ -24,6 +37,8 @@ class MangaLoader : public QObject
     QML_SINGLETON
 
     Q_PROPERTY(int extractionProgress MEMBER m_extractionProgress READ extractionProgress WRITE setExtractionProgress NOTIFY extractionProgressChanged)
+    // index of the page the volume was left at, 0 for volumes that were not read before
+    Q_PROPERTY(int startIndex READ startIndex NOTIFY imagesReady)
 public:
     int extractionProgress();
     void setExtractionProgress(int extractionProgressArg);
@@ -35,31 +50,151 @@ public:
     }
 
     KArchive *archive() const;
+    QList<Image> images() const;
+    /*
+     * Incremented every time a volume is loaded, page indexes
+     * from an older generation belong to a different volume
+     */
+    int generation() const;
+    /*
+     * Reads the (still encoded) page into a pooled buffer, returns a null
+     * buffer on failure. Can be called from any thread, reads are serialized
+     * because the archive's device can't be shared between threads
+     */
+    PooledBuffer readPage(const QString &path);
+    /*
+     * Returns a string that identifies the page and the file it comes from,
+     * it changes when the archive or the image file is modified
+     */
+    QString pageKey(const QString &path) const;
+    /*
+     * Identifies the opened volume, see pageKey()
+     */
+    QString sourceId() const;
+    /*
+     * Opens the volume on a worker thread while the QML engine is still loading,
+     * handlePath() uses the result when it is called with the same path.
+     * If the volume is still opening then, it is shown once it's ready
+     */
+    void preload(const QString &path, qint64 startTime);
+    /*
+     * The page at startIndex at full resolution when it was decoded by preload(), null otherwise.
+     * It's only kept until it is taken, once for each volume
+     */
+    QImage takeStartPage();
+    int startIndex() const;
+    /*
+     * Remembers the page the volume was left at, it is opened there the next time
+     */
+    Q_INVOKABLE void saveReadingPosition(int index);
 
 Q_SIGNALS:
     void extractionProgressChanged();
     void imagesReady(QList<Image> images);
+    /*
+     * The pages far from startIndex are shown with an estimated size at first and probed
+     * in the background, outward from startIndex. Emitted with the same pages in the same order
+     */
+    void imageSizesChanged(QList<Image> images);
 
 public Q_SLOTS:
     void handlePath(const QString &path);
 
 private:
     explicit MangaLoader();
-    ~MangaLoader() = default;
+    ~MangaLoader() override;
     MangaLoader(const MangaLoader &) = delete;
     MangaLoader &operator=(const MangaLoader &) = delete;
     MangaLoader(MangaLoader &&) = delete;
     MangaLoader &operator=(MangaLoader &&) = delete;
 
+    // a volume opened by preload()
+    struct Volume {
+        QString path;
+        QString sourceId;
+        QString pagesFolder;
+        QStringList entries;
+        KArchive *archive{nullptr};
+        QString indexedFile;
+        QList<RepackIndex::Page> indexedPages;
+        QList<Image> images;
+        int startIndex{0};
+        // indexes of the images with an estimated size
+        QList<int> estimatedImages;
+        bool skipFillerPages{false};
+        QImage startPage;
+    };
+
+    // the pages of a volume, the ones around the saved reading position are probed first
+    struct ProbedImages {
+        QList<Image> images;
+        int startIndex{0};
+        // not probed yet, closest to startIndex first
+        QList<int> estimatedImages;
+    };
+
     QStringList dirImages(QString path, bool recursive);
+    static QString makeSourceId(const QFileInfo &fileInfo);
+    static QString makePageKey(const QString &sourceId, const QString &pagesFolder, bool inArchive, const QString &path);
+    // size of the page from its header, invalid if the format is not supported
+    static ImageHeader::Info headerInfo(QIODevice *device);
+    /*
+     * Returns the entries that are images together with their size,
+     * archiveMutex is locked while reading from the archive if it's not null
+     */
+    static QList<Image>
+    probeImages(const QStringList &entries, KArchive *archive, const QString &sourceId, const QString &pagesFolder, QMutex *archiveMutex);
+    /*
+     * Probes all the pages of a volume that wasn't read before. Otherwise only the pages around
+     * the saved position are probed, the others get the size of the saved page for now
+     */
+    static ProbedImages
+    probeVolume(const QStringList &entries, KArchive *archive, const QString &sourceId, const QString &pagesFolder, QMutex *archiveMutex);
+    static QString readingPositionKey(const QString &sourceId);
+    // index of the saved page in `images`, 0 if there is none
+    static int savedIndex(const QList<Image> &images, const QString &sourceId);
+    // probes the estimated images on a worker thread, emitting imageSizesChanged as it goes
+    void startProbing(const QList<int> &estimatedImages);
+    void stopProbing();
+    // the worker threads use `this`, they have to finish before it's deleted
+    void stopThreads();
+    void onPreloadFinished();
+    // pages of a repacked cbz, their order and size come from the index
+    static QList<Image> indexedImages(const QList<RepackIndex::Page> &pages, const QString &sourceId);
+    static PooledBuffer readPage(KArchive *archive, const QString &path);
+    PooledBuffer readSourcePage(const QString &path);
+    void setSource(KArchive *archive, const QString &indexedFile = QString(), const QList<RepackIndex::Page> &indexedPages = {});
     void setupImages(const QStringList &images, KArchive *archive = nullptr);
+    void setupIndexedImages(const QString &file, const QList<RepackIndex::Page> &pages);
+    std::unique_ptr<Volume> openVolume(const QString &path);
+    void usePreloadedVolume(Volume &volume);
 
     QString m_tmpFolder;
     QMimeDatabase m_mimeDB;
     Extractor *m_extractor{};
     int m_extractionProgress{0};
     KArchive *m_archive{};
+    // repacked cbz files are read directly, without KArchive
+    QString m_indexedFile;
+    QHash<QString, RepackIndex::Page> m_indexedPages;
+    // guards m_archive, m_indexedFile, m_indexedPages, m_sourceId and m_pagesFolder
+    // which are used by the image provider threads
+    mutable QMutex m_archiveMutex;
     QList<Image> m_images;
+    int m_generation{0};
+    QString m_sourceId;
+    QString m_pagesFolder;
+    QImage m_startPage;
+    int m_startIndex{0};
+    QThread *m_probeThread{nullptr};
+    std::atomic_bool m_stopProbing{false};
+    QThread *m_preloadThread{nullptr};
+    std::unique_ptr<Volume> m_preloadedVolume;
+    // handlePath() was called before the preload thread finished
+    QString m_preloadPendingPath;
+    qint64 m_startTime{0};
+    // volumes that are not preloaded are timed from handlePath()
+    QElapsedTimer m_openTimer;
 };
 
 #endif // MANGALOADER_H
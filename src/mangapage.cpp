@@ -0,0 +1,500 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "mangapage.h"
+#include "mangaloader.h"
+#include "pagestore.h"
+
+#include <QHash>
+#include <QSet>
+#include <QQuickWindow>
+#include <QSGImageNode>
+#include <QSGTexture>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+namespace
+{
+// textures of pages that are no longer shown are kept up to this size
+constexpr qsizetype MAXIMUM_UNUSED_TEXTURE_BYTES = 256 * 1024 * 1024;
+constexpr int REGION_DELAY = 150;
+
+/*
+ * Textures of a window's pages, keyed by QImage::cacheKey().
+ * Only used on the render thread
+ */
+class PageTextureCache
+{
+public:
+    static PageTextureCache *forWindow(QQuickWindow *window)
+    {
+        static QHash<QQuickWindow *, PageTextureCache *> caches;
+        auto it = caches.find(window);
+        if (it != caches.end()) {
+            return it.value();
+        }
+
+        auto *cache = new PageTextureCache(window);
+        caches.insert(window, cache);
+        // the textures belong to the scene graph, they have to go with it.
+        // The cache is created again for a new scene graph, the window stays connected
+        static QSet<QQuickWindow *> connectedWindows;
+        if (!connectedWindows.contains(window)) {
+            connectedWindows.insert(window);
+            QObject::connect(
+                window,
+                &QQuickWindow::sceneGraphInvalidated,
+                window,
+                [window]() {
+                    delete caches.take(window);
+                },
+                Qt::DirectConnection);
+            QObject::connect(window, &QObject::destroyed, [window]() {
+                connectedWindows.remove(window);
+            });
+        }
+        return cache;
+    }
+
+    ~PageTextureCache()
+    {
+        for (const auto &entry : std::as_const(m_entries)) {
+            delete entry.texture;
+        }
+    }
+
+    QSGTexture *acquire(const QImage &image)
+    {
+        auto it = m_entries.find(image.cacheKey());
+        if (it != m_entries.end()) {
+            if (it->references == 0) {
+                m_unusedBytes -= it->bytes;
+            }
+            ++it->references;
+            return it->texture;
+        }
+
+        QSGTexture *texture = m_window->createTextureFromImage(image);
+        m_entries.insert(image.cacheKey(), {texture, 1, image.sizeInBytes(), 0});
+        return texture;
+    }
+
+    void release(qint64 key)
+    {
+        auto it = m_entries.find(key);
+        if (it == m_entries.end()) {
+            return;
+        }
+        if (--it->references > 0) {
+            return;
+        }
+        it->lastUsed = ++m_clock;
+        m_unusedBytes += it->bytes;
+        prune();
+    }
+
+private:
+    explicit PageTextureCache(QQuickWindow *window)
+        : m_window{window}
+    {
+    }
+
+    void prune()
+    {
+        while (m_unusedBytes > MAXIMUM_UNUSED_TEXTURE_BYTES) {
+            auto oldest = m_entries.end();
+            for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+                if (it->references == 0 && (oldest == m_entries.end() || it->lastUsed < oldest->lastUsed)) {
+                    oldest = it;
+                }
+            }
+            if (oldest == m_entries.end()) {
+                return;
+            }
+            m_unusedBytes -= oldest->bytes;
+            delete oldest->texture;
+            m_entries.erase(oldest);
+        }
+    }
+
+    struct Entry {
+        QSGTexture *texture;
+        int references;
+        qsizetype bytes;
+        quint64 lastUsed;
+    };
+
+    QQuickWindow *m_window;
+    QHash<qint64, Entry> m_entries;
+    qsizetype m_unusedBytes{0};
+    quint64 m_clock{0};
+};
+
+class PageNode : public QSGNode
+{
+public:
+    explicit PageNode(QQuickWindow *window)
+        : m_window{window}
+        , m_cache{PageTextureCache::forWindow(window)}
+        , m_imageNode{window->createImageNode()}
+    {
+        m_imageNode->setOwnsTexture(false);
+        m_imageNode->setFiltering(QSGTexture::Linear);
+        appendChildNode(m_imageNode);
+    }
+
+    ~PageNode() override
+    {
+        m_cache->release(m_cacheKey);
+    }
+
+    qint64 cacheKey() const
+    {
+        return m_cacheKey;
+    }
+
+    void setImage(const QImage &image)
+    {
+        // acquire first, releasing could evict the texture if it is the same one
+        QSGTexture *texture = m_cache->acquire(image);
+        m_cache->release(m_cacheKey);
+        m_cacheKey = image.cacheKey();
+        m_imageNode->setTexture(texture);
+    }
+
+    void setRect(const QRectF &rect)
+    {
+        m_imageNode->setRect(rect);
+    }
+
+    qint64 regionKey() const
+    {
+        return m_regionKey;
+    }
+
+    // regions are only shown once, their textures don't go in the cache
+    void setRegion(const QImage &image)
+    {
+        m_regionKey = image.cacheKey();
+        if (image.isNull()) {
+            if (m_regionNode != nullptr) {
+                removeChildNode(m_regionNode);
+                delete m_regionNode;
+                m_regionNode = nullptr;
+            }
+            m_regionTexture.reset();
+            return;
+        }
+
+        if (m_regionNode == nullptr) {
+            m_regionNode = m_window->createImageNode();
+            m_regionNode->setOwnsTexture(false);
+            m_regionNode->setFiltering(QSGTexture::Linear);
+            appendChildNode(m_regionNode);
+        }
+        std::unique_ptr<QSGTexture> texture(m_window->createTextureFromImage(image));
+        m_regionNode->setTexture(texture.get());
+        m_regionTexture = std::move(texture);
+    }
+
+    void setRegionRect(const QRectF &rect)
+    {
+        if (m_regionNode != nullptr) {
+            m_regionNode->setRect(rect);
+        }
+    }
+
+private:
+    QQuickWindow *m_window;
+    PageTextureCache *m_cache;
+    QSGImageNode *m_imageNode;
+    qint64 m_cacheKey{0};
+    QSGImageNode *m_regionNode{nullptr};
+    std::unique_ptr<QSGTexture> m_regionTexture;
+    qint64 m_regionKey{0};
+};
+} // namespace
+
+MangaPage::MangaPage(QQuickItem *parent)
+    : QQuickItem(parent)
+{
+    setFlag(ItemHasContents, true);
+    connect(PageStore::instance(), &PageStore::pageReady, this, &MangaPage::onPageReady);
+    connect(PageStore::instance(), &PageStore::regionReady, this, &MangaPage::onRegionReady);
+    connect(MangaLoader::instance(), &MangaLoader::imagesReady, this, [this]() {
+        // same index, different volume
+        setImage(QImage());
+        setRegion(QImage(), QRectF());
+        m_requestedSize = QSize();
+        requestImage();
+    });
+
+    m_regionTimer.setSingleShot(true);
+    m_regionTimer.setInterval(REGION_DELAY);
+    connect(&m_regionTimer, &QTimer::timeout, this, &MangaPage::updateRegion);
+}
+
+int MangaPage::pageIndex() const
+{
+    return m_pageIndex;
+}
+
+void MangaPage::setPageIndex(int pageIndex)
+{
+    if (pageIndex == m_pageIndex) {
+        return;
+    }
+    m_pageIndex = pageIndex;
+    setImage(QImage());
+    setRegion(QImage(), QRectF());
+    m_requestedSize = QSize();
+    requestImage();
+    Q_EMIT pageIndexChanged();
+}
+
+bool MangaPage::ready() const
+{
+    return !m_image.isNull();
+}
+
+qreal MangaPage::zoom() const
+{
+    return m_zoom;
+}
+
+void MangaPage::setZoom(qreal zoom)
+{
+    if (qFuzzyCompare(zoom, m_zoom) || zoom <= 0) {
+        return;
+    }
+    m_zoom = zoom;
+    requestImage();
+    Q_EMIT zoomChanged();
+}
+
+bool MangaPage::zooming() const
+{
+    return m_zooming;
+}
+
+void MangaPage::setZooming(bool zooming)
+{
+    if (zooming == m_zooming) {
+        return;
+    }
+    m_zooming = zooming;
+    requestImage();
+    Q_EMIT zoomingChanged();
+}
+
+QSize MangaPage::pixelSize(qreal scale) const
+{
+    const qreal ratio = (window() != nullptr ? window()->effectiveDevicePixelRatio() : 1.0) * scale;
+    return QSize(qRound(width() * ratio), qRound(height() * ratio));
+}
+
+void MangaPage::requestImage()
+{
+    const QSize size = pixelSize();
+    if (m_pageIndex < 0 || size.isEmpty()) {
+        return;
+    }
+
+    if (m_zooming) {
+        // nothing is decoded until the zoom settles, whatever level is there gets stretched
+        const QImage image = PageStore::instance()->closestPage(m_pageIndex, size);
+        if (!image.isNull() && image.cacheKey() != m_image.cacheKey()) {
+            m_requestedSize = QSize();
+            setImage(image);
+        }
+        return;
+    }
+
+    const QSize level = levelSize();
+    // zoomed pages out of view keep the level they have until they are scrolled to
+    m_levelDeferred = false;
+    if (!qFuzzyCompare(m_zoom, 1.0) && level != m_requestedSize && visibleRegion().isEmpty()) {
+        const QImage image = PageStore::instance()->closestPage(m_pageIndex, level);
+        if (!image.isNull()) {
+            if (image.cacheKey() != m_image.cacheKey()) {
+                setImage(image);
+            }
+            m_requestedSize = QSize();
+            m_levelDeferred = true;
+            updateRegion();
+            return;
+        }
+    }
+    if (level != m_requestedSize) {
+        m_requestedSize = level;
+        // while the page at the new size is decoded the old image is stretched
+        const QImage image = PageStore::instance()->page(m_pageIndex, level);
+        if (!image.isNull()) {
+            setImage(image);
+        }
+    }
+    updateRegion();
+}
+
+QSize MangaPage::levelSize() const
+{
+    // zoomed in pages keep their unzoomed size, only the visible region is decoded at the zoomed resolution
+    if (m_zoom >= 1.0) {
+        return pixelSize(1.0 / m_zoom).expandedTo(QSize(1, 1));
+    }
+    // zoomed out pages are decoded at the next power of two, there is a level to stretch when zooming back in
+    const qreal level = std::exp2(std::ceil(std::log2(m_zoom)));
+    return pixelSize(level / m_zoom).expandedTo(QSize(1, 1));
+}
+
+QRectF MangaPage::visibleRegion() const
+{
+    if (window() == nullptr || width() <= 0 || height() <= 0) {
+        return QRectF();
+    }
+    const QRectF visible = mapRectFromScene(QRectF(QPointF(0, 0), window()->size())) & boundingRect();
+    return QRectF(visible.x() / width(), visible.y() / height(), visible.width() / width(), visible.height() / height());
+}
+
+void MangaPage::updateRegion()
+{
+    const QSize size = pixelSize();
+    const QList<Image> images = MangaLoader::instance()->images();
+    const QSize pageSize = m_pageIndex >= 0 && m_pageIndex < images.count() ? images.at(m_pageIndex).size : QSize();
+    // only when the decoded level has less detail than both the screen and the page itself
+    const bool needsRegion = !m_zooming && m_requestedSize.isValid() && m_requestedSize.width() < std::min(size.width(), pageSize.width());
+    watchScrolling(needsRegion || m_levelDeferred);
+    if (!needsRegion) {
+        if (!m_zooming) {
+            setRegion(QImage(), QRectF());
+        }
+        return;
+    }
+
+    const QRectF region = visibleRegion();
+    if (region.isEmpty() || (region == m_requestedRegion && size == m_regionSize)) {
+        return;
+    }
+    m_requestedRegion = region;
+    m_regionSize = size;
+    m_regionRequest = PageStore::instance()->requestRegion(m_pageIndex, size, region);
+}
+
+void MangaPage::onRegionReady(int requestId, const QRectF &region, const QImage &image)
+{
+    if (requestId != m_regionRequest) {
+        return;
+    }
+    setRegion(image, region);
+}
+
+void MangaPage::setRegion(const QImage &image, const QRectF &region)
+{
+    if (image.isNull()) {
+        // anything still being decoded is stale too
+        m_regionRequest = 0;
+        m_requestedRegion = QRectF();
+        m_regionSize = QSize();
+    }
+    if (image.isNull() && m_regionImage.isNull()) {
+        return;
+    }
+    m_regionImage = image;
+    m_region = region;
+    update();
+}
+
+void MangaPage::watchScrolling(bool watch)
+{
+    if (!watch || window() == nullptr) {
+        disconnect(m_scrollConnection);
+        m_scrollConnection = {};
+        m_regionTimer.stop();
+        return;
+    }
+    if (m_scrollConnection) {
+        return;
+    }
+    // scrolling moves the page, not its geometry, so the visible region is checked every frame
+    m_scrollConnection = connect(window(), &QQuickWindow::afterAnimating, this, [this]() {
+        if (m_levelDeferred) {
+            if (!visibleRegion().isEmpty()) {
+                requestImage();
+            }
+            return;
+        }
+        if (visibleRegion() != m_requestedRegion) {
+            m_regionTimer.start();
+        }
+    });
+}
+
+void MangaPage::onPageReady(int index, const QSize &size)
+{
+    if (index != PageStore::instance()->canonicalIndex(m_pageIndex) || size != m_requestedSize) {
+        return;
+    }
+    setImage(PageStore::instance()->page(index, size));
+}
+
+void MangaPage::setImage(const QImage &image)
+{
+    const bool wasReady = ready();
+    m_image = image;
+    update();
+    if (wasReady != ready()) {
+        Q_EMIT readyChanged();
+    }
+}
+
+void MangaPage::geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChange(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size()) {
+        requestImage();
+        update();
+    }
+}
+
+void MangaPage::itemChange(ItemChange change, const ItemChangeData &value)
+{
+    QQuickItem::itemChange(change, value);
+    if (change == ItemSceneChange) {
+        watchScrolling(false);
+        requestImage();
+        updateRegion();
+    } else if (change == ItemDevicePixelRatioHasChanged) {
+        requestImage();
+        update();
+    }
+}
+
+QSGNode *MangaPage::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *)
+{
+    auto *node = static_cast<PageNode *>(oldNode);
+    if (m_image.isNull() || width() <= 0 || height() <= 0) {
+        delete node;
+        return nullptr;
+    }
+
+    if (node == nullptr) {
+        node = new PageNode(window());
+    }
+    if (node->cacheKey() != m_image.cacheKey()) {
+        node->setImage(m_image);
+    }
+    node->setRect(boundingRect());
+    if (node->regionKey() != m_regionImage.cacheKey()) {
+        node->setRegion(m_regionImage);
+    }
+    node->setRegionRect(QRectF(m_region.x() * width(), m_region.y() * height(), m_region.width() * width(), m_region.height() * height()));
+
+    return node;
+}
+
+#include "moc_mangapage.cpp"
@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef MANGAPAGE_H
+#define MANGAPAGE_H
+
+#include <QImage>
+#include <QQuickItem>
+#include <QTimer>
+
+/*
+ * Shows a page of the current volume, taking the decoded image straight from
+ * the PageStore at the item's size in device pixels. The textures of recently
+ * shown pages are kept around, so scrolling back to a page doesn't decode or
+ * upload it again.
+ *
+ * While zooming the closest decoded size of a page is stretched. Once zooming
+ * stops, zoomed in pages keep their unzoomed size with a detailed copy of just the
+ * visible region drawn on top, zoomed out pages are decoded at power of two levels.
+ * Pages out of view are left stretched until they are scrolled to.
+ */
+class MangaPage : public QQuickItem
+{
+    Q_OBJECT
+    QML_ELEMENT
+
+    Q_PROPERTY(int pageIndex READ pageIndex WRITE setPageIndex NOTIFY pageIndexChanged)
+    Q_PROPERTY(bool ready READ ready NOTIFY readyChanged)
+    // the item is this much bigger than the page at its normal size
+    Q_PROPERTY(qreal zoom READ zoom WRITE setZoom NOTIFY zoomChanged)
+    // nothing is decoded while this is true
+    Q_PROPERTY(bool zooming READ zooming WRITE setZooming NOTIFY zoomingChanged)
+
+public:
+    explicit MangaPage(QQuickItem *parent = nullptr);
+
+    int pageIndex() const;
+    void setPageIndex(int pageIndex);
+
+    bool ready() const;
+
+    qreal zoom() const;
+    void setZoom(qreal zoom);
+
+    bool zooming() const;
+    void setZooming(bool zooming);
+
+Q_SIGNALS:
+    void pageIndexChanged();
+    void readyChanged();
+    void zoomChanged();
+    void zoomingChanged();
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *) override;
+    void geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+    void itemChange(ItemChange change, const ItemChangeData &value) override;
+
+private:
+    // the size of the item on screen in device pixels, times `scale`
+    QSize pixelSize(qreal scale = 1.0) const;
+    void requestImage();
+    void onPageReady(int index, const QSize &size);
+    void setImage(const QImage &image);
+    QSize levelSize() const;
+    QRectF visibleRegion() const;
+    void updateRegion();
+    void onRegionReady(int requestId, const QRectF &region, const QImage &image);
+    void setRegion(const QImage &image, const QRectF &region);
+    void watchScrolling(bool watch);
+
+    int m_pageIndex{-1};
+    QSize m_requestedSize;
+    QImage m_image;
+    qreal m_zoom{1.0};
+    bool m_zooming{false};
+    // out of view while zoomed, the level is requested once the page is visible
+    bool m_levelDeferred{false};
+    // detail of the visible part of the page, in 0-1 page coordinates
+    QImage m_regionImage;
+    QRectF m_region;
+    QRectF m_requestedRegion;
+    QSize m_regionSize;
+    int m_regionRequest{0};
+    // the visible region is decoded again once scrolling stops
+    QTimer m_regionTimer;
+    QMetaObject::Connection m_scrollConnection;
+};
+
+#endif // MANGAPAGE_H
@@ -0,0 +1,315 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "nativedecoder.h"
+#include "bufferpool.h"
+#include "imageheader.h"
+
+#include <QScopeGuard>
+#include <QThread>
+#include <QtEndian>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#ifdef WITH_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+#ifdef WITH_WEBP
+#include <webp/decode.h>
+#endif
+#ifdef WITH_AVIF
+#include <avif/avif.h>
+#endif
+#ifdef WITH_JXL
+#include <jxl/decode_cxx.h>
+#include <jxl/thread_parallel_runner_cxx.h>
+#endif
+
+namespace
+{
+[[maybe_unused]] constexpr bool LITTLE_ENDIAN_HOST = Q_BYTE_ORDER == Q_LITTLE_ENDIAN;
+
+// the most threads each codec still decodes a page faster with
+[[maybe_unused]] constexpr int WEBP_MAXIMUM_THREADS = 2;
+[[maybe_unused]] constexpr int AVIF_MAXIMUM_THREADS = 4;
+[[maybe_unused]] constexpr int JXL_MAXIMUM_THREADS = 8;
+
+// decodes running at the same time, usually one per busy PageStore thread
+std::atomic<int> runningDecodes{0};
+
+/*
+ * Pages are decoded on a thread pool with a thread per core already, while it is
+ * busy more threads per decode only compete with the other decodes.
+ * A decode gets the cores no other decode is using, at least one
+ */
+[[maybe_unused]] int threadCount(int maximum)
+{
+    const int idleThreads = QThread::idealThreadCount() - runningDecodes.load(std::memory_order_relaxed) + 1;
+    return std::clamp(idleThreads, 1, maximum);
+}
+
+// the size the page is shown at, never more than the size of the image
+[[maybe_unused]] QSize targetSize(const QSize &size, const QSize &requestedSize)
+{
+    if (requestedSize.isEmpty()) {
+        return size;
+    }
+    return size.scaled(requestedSize, Qt::KeepAspectRatio).boundedTo(size);
+}
+
+bool isJpeg(const QByteArray &data)
+{
+    return data.startsWith("\xff\xd8\xff");
+}
+
+bool isWebp(const QByteArray &data)
+{
+    return data.size() >= 12 && data.startsWith("RIFF") && data.mid(8, 4) == "WEBP";
+}
+
+bool isAvif(const QByteArray &data)
+{
+    if (data.size() < 16 || data.mid(4, 4) != "ftyp") {
+        return false;
+    }
+    // major brand, then the compatible brands after the minor version
+    const qsizetype boxSize = std::min<qsizetype>(qFromBigEndian<quint32>(data.constData()), data.size());
+    for (qsizetype pos = 8; pos + 4 <= boxSize; pos += pos == 8 ? 8 : 4) {
+        const QByteArray brand = data.mid(pos, 4);
+        if (brand == "avif" || brand == "avis") {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isJxl(const QByteArray &data)
+{
+    return data.startsWith("\xff\x0a") || data.startsWith(QByteArrayView("\x00\x00\x00\x0cJXL \x0d\x0a\x87\x0a", 12));
+}
+
+#ifdef WITH_TURBOJPEG
+QImage decodeJpeg(const QByteArray &data, const QSize &requestedSize)
+{
+    // turbojpeg doesn't apply the exif orientation, QImageReader does
+    ImageHeader::Info info;
+    if (ImageHeader::parse(data, &info) == ImageHeader::Result::Ok && info.orientation != 1) {
+        return QImage();
+    }
+
+    std::unique_ptr<void, decltype(&tj3Destroy)> handle(tj3Init(TJINIT_DECOMPRESS), tj3Destroy);
+    const auto *jpeg = reinterpret_cast<const unsigned char *>(data.constData());
+    if (handle == nullptr || tj3DecompressHeader(handle.get(), jpeg, data.size()) != 0) {
+        return QImage();
+    }
+    const int colorspace = tj3Get(handle.get(), TJPARAM_COLORSPACE);
+    if (colorspace == TJCS_CMYK || colorspace == TJCS_YCCK) {
+        return QImage();
+    }
+    const QSize size(tj3Get(handle.get(), TJPARAM_JPEGWIDTH), tj3Get(handle.get(), TJPARAM_JPEGHEIGHT));
+
+    // the smallest dct scaling that is still at least as big as the page is shown
+    const QSize target = targetSize(size, requestedSize);
+    int scalingFactorCount = 0;
+    const tjscalingfactor *scalingFactors = tj3GetScalingFactors(&scalingFactorCount);
+    tjscalingfactor scalingFactor = TJUNSCALED;
+    QSize decodedSize = size;
+    for (int i = 0; i < scalingFactorCount; ++i) {
+        const tjscalingfactor factor = scalingFactors[i];
+        const QSize scaledSize(TJSCALED(size.width(), factor), TJSCALED(size.height(), factor));
+        if (factor.num <= factor.denom && scaledSize.width() >= target.width() && scaledSize.height() >= target.height()
+            && scaledSize.width() < decodedSize.width()) {
+            scalingFactor = factor;
+            decodedSize = scaledSize;
+        }
+    }
+    if (tj3SetScalingFactor(handle.get(), scalingFactor) != 0) {
+        return QImage();
+    }
+
+    const bool grayscale = colorspace == TJCS_GRAY;
+    QImage image = BufferPool::instance()->image(decodedSize, grayscale ? QImage::Format_Grayscale8 : QImage::Format_RGB32);
+    const int pixelFormat = grayscale ? TJPF_GRAY : (LITTLE_ENDIAN_HOST ? TJPF_BGRX : TJPF_XRGB);
+    // warnings about slightly broken files still leave a usable image
+    if (tj3Decompress8(handle.get(), jpeg, data.size(), image.bits(), image.bytesPerLine(), pixelFormat) != 0
+        && tj3GetErrorCode(handle.get()) == TJERR_FATAL) {
+        return QImage();
+    }
+    return image;
+}
+#endif
+
+#ifdef WITH_WEBP
+QImage decodeWebp(const QByteArray &data, const QSize &requestedSize)
+{
+    WebPDecoderConfig config;
+    const auto *webp = reinterpret_cast<const uint8_t *>(data.constData());
+    if (!WebPInitDecoderConfig(&config) || WebPGetFeatures(webp, data.size(), &config.input) != VP8_STATUS_OK) {
+        return QImage();
+    }
+    if (config.input.has_animation) {
+        return QImage();
+    }
+
+    const QSize size(config.input.width, config.input.height);
+    const QSize decodedSize = targetSize(size, requestedSize);
+    if (decodedSize != size) {
+        config.options.use_scaling = 1;
+        config.options.scaled_width = decodedSize.width();
+        config.options.scaled_height = decodedSize.height();
+    }
+    // libwebp only has one extra thread, for filtering
+    config.options.use_threads = threadCount(WEBP_MAXIMUM_THREADS) > 1;
+
+    const bool alpha = config.input.has_alpha;
+    QImage image = BufferPool::instance()->image(decodedSize, alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    if (LITTLE_ENDIAN_HOST) {
+        config.output.colorspace = alpha ? MODE_bgrA : MODE_BGRA;
+    } else {
+        config.output.colorspace = alpha ? MODE_Argb : MODE_ARGB;
+    }
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = image.bits();
+    config.output.u.RGBA.stride = image.bytesPerLine();
+    config.output.u.RGBA.size = image.sizeInBytes();
+
+    const bool ok = WebPDecode(webp, data.size(), &config) == VP8_STATUS_OK;
+    WebPFreeDecBuffer(&config.output);
+    return ok ? image : QImage();
+}
+#endif
+
+#ifdef WITH_AVIF
+QImage decodeAvif(const QByteArray &data)
+{
+    std::unique_ptr<avifDecoder, decltype(&avifDecoderDestroy)> decoder(avifDecoderCreate(), avifDecoderDestroy);
+    if (decoder == nullptr) {
+        return QImage();
+    }
+    decoder->maxThreads = threadCount(AVIF_MAXIMUM_THREADS);
+    decoder->ignoreExif = AVIF_TRUE;
+    decoder->ignoreXMP = AVIF_TRUE;
+    if (avifDecoderSetIOMemory(decoder.get(), reinterpret_cast<const uint8_t *>(data.constData()), data.size()) != AVIF_RESULT_OK
+        || avifDecoderParse(decoder.get()) != AVIF_RESULT_OK || avifDecoderNextImage(decoder.get()) != AVIF_RESULT_OK) {
+        return QImage();
+    }
+    const avifImage *avif = decoder->image;
+    // rotated and mirrored images are left to QImageReader
+    if (avif->transformFlags & (AVIF_TRANSFORM_IROT | AVIF_TRANSFORM_IMIR)) {
+        return QImage();
+    }
+
+    const bool alpha = avif->alphaPlane != nullptr;
+    QImage image = BufferPool::instance()->image(QSize(avif->width, avif->height), alpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+    avifRGBImage rgb;
+    avifRGBImageSetDefaults(&rgb, avif);
+    rgb.format = LITTLE_ENDIAN_HOST ? AVIF_RGB_FORMAT_BGRA : AVIF_RGB_FORMAT_ARGB;
+    rgb.depth = 8;
+    rgb.alphaPremultiplied = AVIF_TRUE;
+    rgb.maxThreads = threadCount(AVIF_MAXIMUM_THREADS);
+    rgb.pixels = image.bits();
+    rgb.rowBytes = image.bytesPerLine();
+    if (avifImageYUVToRGB(avif, &rgb) != AVIF_RESULT_OK) {
+        return QImage();
+    }
+    return image;
+}
+#endif
+
+#ifdef WITH_JXL
+QImage decodeJxl(const QByteArray &data)
+{
+    JxlDecoderPtr decoder = JxlDecoderMake(nullptr);
+    JxlThreadParallelRunnerPtr runner = JxlThreadParallelRunnerMake(nullptr, threadCount(JXL_MAXIMUM_THREADS));
+    if (decoder == nullptr || runner == nullptr
+        || JxlDecoderSubscribeEvents(decoder.get(), JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS
+        || JxlDecoderSetParallelRunner(decoder.get(), JxlThreadParallelRunner, runner.get()) != JXL_DEC_SUCCESS
+        || JxlDecoderSetInput(decoder.get(), reinterpret_cast<const uint8_t *>(data.constData()), data.size()) != JXL_DEC_SUCCESS) {
+        return QImage();
+    }
+    JxlDecoderCloseInput(decoder.get());
+
+    // rows aligned to 4 bytes, like QImage's
+    JxlPixelFormat pixelFormat{4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 4};
+    QImage image;
+    for (;;) {
+        switch (JxlDecoderProcessInput(decoder.get())) {
+        case JXL_DEC_BASIC_INFO: {
+            JxlBasicInfo info;
+            if (JxlDecoderGetBasicInfo(decoder.get(), &info) != JXL_DEC_SUCCESS) {
+                return QImage();
+            }
+            QSize size(info.xsize, info.ysize);
+            // the orientation is applied while decoding
+            if (info.orientation > JXL_ORIENT_FLIP_VERTICAL) {
+                size.transpose();
+            }
+            QImage::Format format = QImage::Format_RGBX8888;
+            if (info.alpha_bits > 0) {
+                format = QImage::Format_RGBA8888;
+            } else if (info.num_color_channels == 1) {
+                pixelFormat.num_channels = 1;
+                format = QImage::Format_Grayscale8;
+            }
+            image = BufferPool::instance()->image(size, format);
+            break;
+        }
+        case JXL_DEC_NEED_IMAGE_OUT_BUFFER: {
+            size_t bufferSize = 0;
+            if (image.isNull() || JxlDecoderImageOutBufferSize(decoder.get(), &pixelFormat, &bufferSize) != JXL_DEC_SUCCESS
+                || bufferSize > size_t(image.sizeInBytes())
+                || JxlDecoderSetImageOutBuffer(decoder.get(), &pixelFormat, image.bits(), image.sizeInBytes()) != JXL_DEC_SUCCESS) {
+                return QImage();
+            }
+            break;
+        }
+        case JXL_DEC_FULL_IMAGE:
+            // only the first frame of animations
+            return image;
+        default:
+            return QImage();
+        }
+    }
+}
+#endif
+} // namespace
+
+QImage NativeDecoder::decode(const QByteArray &data, const QSize &requestedSize, QByteArray *format)
+{
+    Q_UNUSED(requestedSize)
+    Q_UNUSED(format)
+
+    ++runningDecodes;
+    const auto finished = qScopeGuard([]() {
+        --runningDecodes;
+    });
+
+    if (isJpeg(data)) {
+#ifdef WITH_TURBOJPEG
+        *format = QByteArrayLiteral("jpeg (libjpeg-turbo)");
+        return decodeJpeg(data, requestedSize);
+#endif
+    } else if (isWebp(data)) {
+#ifdef WITH_WEBP
+        *format = QByteArrayLiteral("webp (libwebp)");
+        return decodeWebp(data, requestedSize);
+#endif
+    } else if (isAvif(data)) {
+#ifdef WITH_AVIF
+        *format = QByteArrayLiteral("avif (libavif)");
+        return decodeAvif(data);
+#endif
+    } else if (isJxl(data)) {
+#ifdef WITH_JXL
+        *format = QByteArrayLiteral("jxl (libjxl)");
+        return decodeJxl(data);
+#endif
+    }
+
+    return QImage();
+}
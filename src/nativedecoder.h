@@ -0,0 +1,32 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef NATIVEDECODER_H
+#define NATIVEDECODER_H
+
+#include <QByteArray>
+#include <QImage>
+
+/*
+ * Decodes jpeg, webp, avif and jpeg xl pages with libjpeg-turbo, libwebp,
+ * libavif and libjxl directly, for the backends rakki was built with
+ * (WITH_TURBOJPEG, WITH_WEBP, WITH_AVIF and WITH_JXL). webp, avif and jxl
+ * decode on the cores other decodes leave idle, jpeg and webp are scaled down
+ * while decoding.
+ */
+namespace NativeDecoder
+{
+/*
+ * Returns the decoded page, no smaller than it is when scaled to fit `requestedSize`,
+ * so it still has to be scaled to the exact size. An invalid `requestedSize` decodes
+ * at full resolution. Returns a null image for formats without a backend and for
+ * images a backend doesn't handle, those are left to QImageReader.
+ * `format` is set to the name of the backend that decoded the image
+ */
+QImage decode(const QByteArray &data, const QSize &requestedSize, QByteArray *format);
+}
+
+#endif // NATIVEDECODER_H
@@ -0,0 +1,179 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "pagecache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+#include <algorithm>
+
+#include "perfstats.h"
+#include "qoi.h"
+
+using namespace Qt::StringLiterals;
+
+namespace
+{
+// changes whenever cached pages decoded by older versions can't be used anymore,
+// 2: rotated jpegs are decoded upright
+constexpr int CACHE_VERSION = 2;
+} // namespace
+
+PageCache::PageCache()
+    : QObject()
+{
+    m_folder = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + u"/pages"_s;
+    QDir().mkpath(m_folder);
+}
+
+PageCache *PageCache::instance()
+{
+    static PageCache *c = new PageCache();
+    return c;
+}
+
+QImage PageCache::find(const QString &pageKey, const QSize &size)
+{
+    if (!enabled() || pageKey.isEmpty()) {
+        return QImage();
+    }
+
+    QFile file(filePath(pageKey, size));
+    if (!file.open(QIODevice::ReadOnly)) {
+        PerfStats::instance()->addDiskCacheLookup(false);
+        return QImage();
+    }
+    PooledBuffer data(file.size());
+    data.truncate(std::max<qint64>(file.read(data.data(), data.size()), 0));
+    // the modification time is used for the least recently used pruning
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    file.close();
+
+    QImage image = Qoi::decode(data.byteArray());
+    if (image.isNull()) {
+        file.remove();
+    }
+    PerfStats::instance()->addDiskCacheLookup(!image.isNull());
+    return image;
+}
+
+qint64 PageCache::usedBytes()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_usedBytes;
+}
+
+void PageCache::insert(const QString &pageKey, const QSize &size, const QImage &image)
+{
+    if (!enabled() || pageKey.isEmpty() || image.isNull()) {
+        return;
+    }
+
+    // encoding takes a few milliseconds, don't delay showing the page
+    const QString path = filePath(pageKey, size);
+    QThreadPool::globalInstance()->start([this, path, image]() {
+        write(path, image);
+    });
+}
+
+void PageCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    QDir(m_folder).removeRecursively();
+    QDir().mkpath(m_folder);
+    m_usedBytes = 0;
+}
+
+void PageCache::write(const QString &path, const QImage &image)
+{
+    if (QFile::exists(path)) {
+        return;
+    }
+
+    PooledBuffer data = Qoi::encode(image);
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    file.write(data.data(), data.size());
+    if (!file.commit()) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (m_usedBytes < 0) {
+        m_usedBytes = 0;
+        const auto files = QDir(m_folder).entryInfoList(QDir::Files);
+        for (const auto &fi : files) {
+            m_usedBytes += fi.size();
+        }
+    } else {
+        m_usedBytes += data.size();
+    }
+
+    if (m_usedBytes > qint64(maximumSize()) * 1024 * 1024) {
+        prune();
+    }
+}
+
+void PageCache::prune()
+{
+    // prune down to 90% of the limit so that not every insert has to prune
+    const qint64 target = qint64(maximumSize()) * 1024 * 1024 * 9 / 10;
+    // oldest first
+    const auto files = QDir(m_folder).entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+    for (const auto &fi : files) {
+        if (m_usedBytes <= target) {
+            break;
+        }
+        if (QFile::remove(fi.absoluteFilePath())) {
+            m_usedBytes -= fi.size();
+        }
+    }
+}
+
+QString PageCache::filePath(const QString &pageKey, const QSize &size) const
+{
+    const QString key = u"%1|%2x%3|%4"_s.arg(pageKey).arg(size.width()).arg(size.height()).arg(CACHE_VERSION);
+    const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return m_folder + u"/"_s + QString::fromLatin1(hash) + u".qoi"_s;
+}
+
+bool PageCache::enabled()
+{
+    return m_enabled;
+}
+
+void PageCache::setEnabled(bool enabled)
+{
+    if (enabled == m_enabled) {
+        return;
+    }
+    m_enabled = enabled;
+    Q_EMIT enabledChanged();
+}
+
+int PageCache::maximumSize()
+{
+    return m_maximumSize;
+}
+
+void PageCache::setMaximumSize(int maximumSize)
+{
+    if (maximumSize == m_maximumSize) {
+        return;
+    }
+    m_maximumSize = maximumSize;
+    Q_EMIT maximumSizeChanged();
+}
+
+#include "moc_pagecache.cpp"
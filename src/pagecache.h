@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QQmlEngine>
+
+#include <atomic>
+
+/*
+ * On-disk cache of pages that were already decoded and scaled to the size
+ * requested by the view. Reopening a volume loads the pages from here
+ * instead of going through the (slow) jpeg/webp/avif/jxl decoders.
+ */
+class PageCache : public QObject
+{
+    Q_OBJECT
+    QML_ELEMENT
+    QML_SINGLETON
+
+    Q_PROPERTY(bool enabled READ enabled WRITE setEnabled NOTIFY enabledChanged)
+    // maximum size of the cache folder in MiB
+    Q_PROPERTY(int maximumSize READ maximumSize WRITE setMaximumSize NOTIFY maximumSizeChanged)
+
+public:
+    static PageCache *instance();
+    static PageCache *create(QQmlEngine *, QJSEngine *)
+    {
+        return instance();
+    }
+
+    bool enabled();
+    void setEnabled(bool enabled);
+
+    int maximumSize();
+    void setMaximumSize(int maximumSize);
+
+    /*
+     * Returns the cached page or a null image if the page is not cached.
+     * `pageKey` identifies the page, by its source (see MangaLoader::pageKey) or its content
+     */
+    QImage find(const QString &pageKey, const QSize &size);
+    /*
+     * Stores the page in the background, pruning the least recently used
+     * pages when the cache grows past maximumSize
+     */
+    void insert(const QString &pageKey, const QSize &size, const QImage &image);
+    // bytes used by the cache folder, -1 until the first insert scanned it
+    qint64 usedBytes();
+
+    Q_INVOKABLE void clear();
+
+Q_SIGNALS:
+    void enabledChanged();
+    void maximumSizeChanged();
+
+private:
+    explicit PageCache();
+    ~PageCache() = default;
+    PageCache(const PageCache &) = delete;
+    PageCache &operator=(const PageCache &) = delete;
+    PageCache(PageCache &&) = delete;
+    PageCache &operator=(PageCache &&) = delete;
+
+    QString filePath(const QString &pageKey, const QSize &size) const;
+    void write(const QString &path, const QImage &image);
+    void prune();
+
+    QMutex m_mutex;
+    QString m_folder;
+    std::atomic_bool m_enabled{true};
+    std::atomic_int m_maximumSize{1024};
+    // bytes used by the cache folder, -1 until the folder was scanned
+    qint64 m_usedBytes{-1};
+};
+
+#endif // PAGECACHE_H
@@ -0,0 +1,163 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "pagedecoder.h"
+#include "bufferpool.h"
+#include "imagescaler.h"
+#include "mangaloader.h"
+#include "nativedecoder.h"
+#include "pagecache.h"
+#include "pagehashindex.h"
+#include "perfstats.h"
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QImageReader>
+
+using namespace Qt::StringLiterals;
+
+QImage PageDecoder::decode(const QString &path, const QSize &requestedSize, bool grayscale, quint64 contentHash)
+{
+    const QString sourceId = MangaLoader::instance()->sourceId();
+    const QString pageKey = MangaLoader::instance()->pageKey(path);
+    PageHashIndex *hashIndex = PageHashIndex::instance();
+    if (contentHash == 0) {
+        contentHash = hashIndex->hashes(sourceId, pageKey).content;
+    }
+    // identical pages, like the credits repeated in every volume of a series, share their cache file
+    const QString cacheKey = contentHash != 0 ? u"content|%1"_s.arg(contentHash, 16, 16, u'0') : pageKey;
+    QImage page = PageCache::instance()->find(cacheKey, requestedSize);
+    if (!page.isNull()) {
+        if (!hashIndex->contains(sourceId, pageKey)) {
+            hashIndex->insert(sourceId, pageKey, {0, PageHashIndex::perceptualHash(page)});
+        }
+        return page;
+    }
+
+    // the compressed data, the decoded image and the scaled image all use pooled buffers
+    const PooledBuffer data = MangaLoader::instance()->readPage(path);
+    if (data.isNull()) {
+        return QImage();
+    }
+    const QByteArray bytes = data.byteArray();
+    QImage image = decode(bytes, requestedSize);
+    if (image.isNull()) {
+        return QImage();
+    }
+    // gray pages saved as color images, a quarter of the pixels to scale and keep in memory
+    if (grayscale && !image.hasAlphaChannel() && image.format() != QImage::Format_Grayscale8) {
+        image = image.convertToFormat(QImage::Format_Grayscale8);
+    }
+    page = ImageScaler::scaled(image, image.size().scaled(requestedSize, Qt::KeepAspectRatio));
+
+    // don't store anything under the old key if another volume was opened while decoding
+    if (MangaLoader::instance()->pageKey(path) == pageKey) {
+        PageCache::instance()->insert(cacheKey, requestedSize, page);
+        if (!hashIndex->contains(sourceId, pageKey)) {
+            hashIndex->insert(sourceId, pageKey, {PageHashIndex::contentHash(bytes), PageHashIndex::perceptualHash(page)});
+        }
+    }
+
+    return page;
+}
+
+QImage PageDecoder::decode(const QByteArray &data, const QSize &requestedSize)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray format;
+    QImage image = NativeDecoder::decode(data, requestedSize, &format);
+    if (!image.isNull()) {
+        PerfStats::instance()->addDecode(format, timer.nsecsElapsed());
+        return image;
+    }
+
+    QByteArray bytes = data;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::ReadOnly);
+
+    QImageReader imageReader(&buffer);
+    // pages are shown upright, like the sizes read from their headers
+    imageReader.setAutoTransform(true);
+    timer.start();
+    image = BufferPool::instance()->image(imageReader.size(), imageReader.imageFormat());
+    if (!imageReader.read(&image)) {
+        return QImage();
+    }
+    PerfStats::instance()->addDecode(imageReader.format(), timer.nsecsElapsed());
+    return image;
+}
+
+QImage PageDecoder::decodeRegion(const QString &path, const QSize &size, const QRectF &region, bool grayscale, QRectF *coveredRegion, QImage *fullPage)
+{
+    auto clipRectOf = [&region](const QSize &pageSize) {
+        const QRectF pageRegion(region.x() * pageSize.width(), region.y() * pageSize.height(), region.width() * pageSize.width(), region.height() * pageSize.height());
+        return pageRegion.toAlignedRect() & QRect(QPoint(0, 0), pageSize);
+    };
+
+    QSize pageSize;
+    QRect clipRect;
+    QImage image;
+    if (!fullPage->isNull()) {
+        pageSize = fullPage->size();
+        clipRect = clipRectOf(pageSize);
+        image = fullPage->copy(clipRect);
+    } else {
+        const PooledBuffer data = MangaLoader::instance()->readPage(path);
+        if (data.isNull()) {
+            return QImage();
+        }
+        QByteArray bytes = data.byteArray();
+        QBuffer buffer(&bytes);
+        buffer.open(QIODevice::ReadOnly);
+
+        QImageReader imageReader(&buffer);
+        imageReader.setAutoTransform(true);
+        // the clip rect applies before the exif rotation, only upright jpegs decode just the clipped part
+        if (imageReader.supportsOption(QImageIOHandler::ClipRect) && imageReader.transformation() == QImageIOHandler::TransformationNone) {
+            pageSize = imageReader.size();
+            clipRect = clipRectOf(pageSize);
+            if (clipRect.isEmpty()) {
+                return QImage();
+            }
+            imageReader.setClipRect(clipRect);
+            QElapsedTimer timer;
+            timer.start();
+            image = imageReader.read();
+            PerfStats::instance()->addDecode(imageReader.format() + QByteArrayLiteral(" region"), timer.nsecsElapsed());
+        } else {
+            // the whole page has to be decoded, it is kept for the next regions of the same page
+            QImage page = decode(bytes);
+            if (page.isNull()) {
+                return QImage();
+            }
+            if (grayscale && !page.hasAlphaChannel() && page.format() != QImage::Format_Grayscale8) {
+                page = page.convertToFormat(QImage::Format_Grayscale8);
+            }
+            *fullPage = page;
+            pageSize = page.size();
+            clipRect = clipRectOf(pageSize);
+            image = page.copy(clipRect);
+        }
+    }
+    if (image.isNull() || clipRect.isEmpty()) {
+        return QImage();
+    }
+    if (grayscale && !image.hasAlphaChannel() && image.format() != QImage::Format_Grayscale8) {
+        image = image.convertToFormat(QImage::Format_Grayscale8);
+    }
+
+    *coveredRegion = QRectF(qreal(clipRect.x()) / pageSize.width(),
+                            qreal(clipRect.y()) / pageSize.height(),
+                            qreal(clipRect.width()) / pageSize.width(),
+                            qreal(clipRect.height()) / pageSize.height());
+    // above the page's own resolution the gpu scales it up
+    const qreal scale = qreal(size.width()) / pageSize.width();
+    if (scale >= 1.0) {
+        return image;
+    }
+    return ImageScaler::scaled(image, (QSizeF(clipRect.size()) * scale).toSize().expandedTo(QSize(1, 1)));
+}
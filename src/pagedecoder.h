@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PAGEDECODER_H
+#define PAGEDECODER_H
+
+#include <QImage>
+
+class PageDecoder
+{
+public:
+    /*
+     * Returns the page of the currently opened volume scaled to fit `requestedSize`.
+     * Looks in the disk cache first and stores newly decoded pages there.
+     * Pages known to be grayscale are converted before scaling them.
+     * Pages with a known `contentHash` are cached by it, so identical pages of
+     * different volumes are only decoded once. Safe to call from any thread
+     */
+    static QImage decode(const QString &path, const QSize &requestedSize, bool grayscale = false, quint64 contentHash = 0);
+    /*
+     * Decodes encoded image data upright, with the native decoders when they support the format (see NativeDecoder),
+     * otherwise with QImageReader. Native decoders may scale down to no less than `requestedSize`,
+     * by default the image is decoded at full resolution
+     */
+    static QImage decode(const QByteArray &data, const QSize &requestedSize = QSize());
+    /*
+     * Decodes only `region` (in 0-1 page coordinates) of the page, at the resolution it has when
+     * the whole page is shown at `size` but never more than the resolution of the page itself.
+     * `coveredRegion` is set to the region the image actually covers after rounding to pixels.
+     * Formats that can't decode just a part of the image are decoded whole, the page is
+     * returned in `fullPage` and cropped instead of decoded when it's passed in again
+     */
+    static QImage decodeRegion(const QString &path, const QSize &size, const QRectF &region, bool grayscale, QRectF *coveredRegion, QImage *fullPage);
+};
+
+#endif // PAGEDECODER_H
@@ -0,0 +1,369 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "pagehashindex.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <bit>
+
+using namespace Qt::StringLiterals;
+
+namespace
+{
+constexpr quint32 FILE_VERSION = 1;
+// pages with at most this many different bits are considered the same page
+constexpr int MAXIMUM_DISTANCE = 4;
+// a page is filler when similar pages are found in this many other volumes
+constexpr int FILLER_VOLUME_COUNT = 3;
+// nearly blank pages have hashes with few bits set, they repeat everywhere
+// but are part of the volumes, so they are never treated as filler
+constexpr int MINIMUM_FILLER_BITS = 8;
+// hashes of the volumes read least recently are dropped beyond this
+constexpr qsizetype MAXIMUM_VOLUMES = 2000;
+// hashes at most MAXIMUM_DISTANCE bits apart have at least one of these blocks of bits in common,
+// so similar hashes are only looked for in the buckets of the hash's own blocks
+constexpr int HASH_BLOCKS = MAXIMUM_DISTANCE + 1;
+// volumes that have at least this share of their pages in common are copies of the same volume,
+// a few shared credit pages are far below it
+constexpr double MINIMUM_SHARED_PAGES = 0.5;
+// with fewer hashed pages it can't be told whether two volumes are copies
+constexpr qsizetype MINIMUM_COMPARED_PAGES = 8;
+
+quint32 bucketKey(quint64 hash, int block)
+{
+    const int first = block * 64 / HASH_BLOCKS;
+    const int last = (block + 1) * 64 / HASH_BLOCKS;
+    const quint64 bits = (hash >> first) & ((quint64(1) << (last - first)) - 1);
+    return (quint32(block) << 16) | quint32(bits);
+}
+} // namespace
+
+PageHashIndex::PageHashIndex()
+    : QObject()
+{
+    m_file = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + u"/pagehashes.dat"_s;
+
+    m_saveTimer.setParent(this);
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(5000);
+    connect(&m_saveTimer, &QTimer::timeout, this, &PageHashIndex::save);
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &PageHashIndex::save);
+}
+
+PageHashIndex *PageHashIndex::instance()
+{
+    static PageHashIndex *i = []() {
+        auto *index = new PageHashIndex();
+        // instance() can be called first from a decoding thread
+        index->moveToThread(QCoreApplication::instance()->thread());
+        return index;
+    }();
+    return i;
+}
+
+quint64 PageHashIndex::perceptualHash(const QImage &image)
+{
+    if (image.isNull()) {
+        return 0;
+    }
+
+    constexpr int columns = 9;
+    constexpr int rows = 8;
+    constexpr int samples = 4;
+    int cells[rows][columns] = {};
+    const int width = image.width();
+    const int height = image.height();
+    for (int row = 0; row < rows; ++row) {
+        for (int sy = 0; sy < samples; ++sy) {
+            const int y = ((row * samples + sy) * 2 + 1) * height / (rows * samples * 2);
+            for (int column = 0; column < columns; ++column) {
+                for (int sx = 0; sx < samples; ++sx) {
+                    const int x = ((column * samples + sx) * 2 + 1) * width / (columns * samples * 2);
+                    cells[row][column] += qGray(image.pixel(x, y));
+                }
+            }
+        }
+    }
+
+    quint64 hash = 0;
+    for (int row = 0; row < rows; ++row) {
+        for (int column = 0; column < columns - 1; ++column) {
+            if (cells[row][column] < cells[row][column + 1]) {
+                hash |= quint64(1) << (row * 8 + column);
+            }
+        }
+    }
+    return hash;
+}
+
+quint64 PageHashIndex::contentHash(const QByteArray &data)
+{
+    return qHashBits(data.constData(), data.size(), 0x9e3779b97f4a7c15);
+}
+
+bool PageHashIndex::contains(const QString &sourceId, const QString &pageKey)
+{
+    QMutexLocker locker(&m_mutex);
+    load();
+    auto it = m_volumes.constFind(sourceId);
+    return it != m_volumes.constEnd() && it->contains(pageKey);
+}
+
+PageHashes PageHashIndex::hashes(const QString &sourceId, const QString &pageKey)
+{
+    QMutexLocker locker(&m_mutex);
+    load();
+    auto it = m_volumes.constFind(sourceId);
+    if (it == m_volumes.constEnd()) {
+        return PageHashes();
+    }
+    touch(sourceId);
+    return it->value(pageKey);
+}
+
+void PageHashIndex::insert(const QString &sourceId, const QString &pageKey, const PageHashes &hashes)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        load();
+        auto &pages = m_volumes[sourceId];
+        // a replaced hash would stay in its bucket
+        m_bucketsDirty = m_bucketsDirty || pages.contains(pageKey);
+        pages.insert(pageKey, hashes);
+        touch(sourceId);
+        if (!m_bucketsDirty) {
+            addToBuckets(sourceId, hashes.perceptual);
+        }
+        removeOldVolumes();
+        m_dirty = true;
+    }
+    QMetaObject::invokeMethod(
+        this,
+        [this]() {
+            if (!m_saveTimer.isActive()) {
+                m_saveTimer.start();
+            }
+        },
+        Qt::QueuedConnection);
+}
+
+bool PageHashIndex::isFiller(const QString &sourceId, quint64 perceptualHash)
+{
+    if (std::popcount(perceptualHash) < MINIMUM_FILLER_BITS) {
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    load();
+    updateBuckets();
+
+    const int volume = m_bucketVolumes.value(sourceId, -1);
+    QSet<int> checkedVolumes{volume};
+    QList<int> otherVolumes;
+    for (int block = 0; block < HASH_BLOCKS; ++block) {
+        const quint32 key = bucketKey(perceptualHash, block);
+        for (auto it = m_buckets.constFind(key); it != m_buckets.cend() && it.key() == key; ++it) {
+            if (std::popcount(it->hash ^ perceptualHash) > MAXIMUM_DISTANCE || checkedVolumes.contains(it->volume)) {
+                continue;
+            }
+            checkedVolumes.insert(it->volume);
+            // the same volume at another path, repacked or downloaded again, is not another volume
+            const int candidate = it->volume;
+            auto isCopy = [this, candidate](int other) {
+                return isSameVolume(other, candidate);
+            };
+            if ((volume >= 0 && isCopy(volume)) || std::any_of(otherVolumes.cbegin(), otherVolumes.cend(), isCopy)) {
+                continue;
+            }
+            otherVolumes.append(candidate);
+            if (otherVolumes.size() >= FILLER_VOLUME_COUNT) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool PageHashIndex::isSameVolume(int a, int b)
+{
+    const QPair<int, int> pair(std::min(a, b), std::max(a, b));
+    const qsizetype sizeA = m_volumeHashes.at(pair.first).size();
+    const qsizetype sizeB = m_volumeHashes.at(pair.second).size();
+    // volumes get more hashes while they are read, compared again once they did
+    const auto cached = m_sameVolumes.constFind(pair);
+    if (cached != m_sameVolumes.cend() && cached->sizeA == sizeA && cached->sizeB == sizeB) {
+        return cached->same;
+    }
+
+    const int smaller = sizeA <= sizeB ? pair.first : pair.second;
+    const int larger = smaller == pair.first ? pair.second : pair.first;
+    const QList<quint64> &hashes = m_volumeHashes.at(smaller);
+    bool same = false;
+    if (hashes.size() >= MINIMUM_COMPARED_PAGES) {
+        qsizetype shared = 0;
+        for (const quint64 hash : hashes) {
+            if (hasSimilarHash(larger, hash)) {
+                ++shared;
+            }
+        }
+        same = shared >= hashes.size() * MINIMUM_SHARED_PAGES;
+    }
+    m_sameVolumes.insert(pair, {sizeA, sizeB, same});
+    return same;
+}
+
+bool PageHashIndex::hasSimilarHash(int volume, quint64 perceptualHash) const
+{
+    for (int block = 0; block < HASH_BLOCKS; ++block) {
+        const quint32 key = bucketKey(perceptualHash, block);
+        for (auto it = m_buckets.constFind(key); it != m_buckets.cend() && it.key() == key; ++it) {
+            if (it->volume == volume && std::popcount(it->hash ^ perceptualHash) <= MAXIMUM_DISTANCE) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void PageHashIndex::touch(const QString &sourceId)
+{
+    if (!m_volumeOrder.isEmpty() && m_volumeOrder.last() == sourceId) {
+        return;
+    }
+    m_volumeOrder.removeOne(sourceId);
+    m_volumeOrder.append(sourceId);
+}
+
+void PageHashIndex::removeOldVolumes()
+{
+    while (m_volumeOrder.count() > MAXIMUM_VOLUMES) {
+        m_volumes.remove(m_volumeOrder.takeFirst());
+        m_bucketsDirty = true;
+    }
+}
+
+void PageHashIndex::addToBuckets(const QString &sourceId, quint64 perceptualHash)
+{
+    // too few bits set to ever be filler, see isFiller()
+    if (std::popcount(perceptualHash) < MINIMUM_FILLER_BITS) {
+        return;
+    }
+    int volume = m_bucketVolumes.value(sourceId, -1);
+    if (volume < 0) {
+        volume = m_bucketVolumes.count();
+        m_bucketVolumes.insert(sourceId, volume);
+        m_volumeHashes.append(QList<quint64>());
+    }
+    m_volumeHashes[volume].append(perceptualHash);
+    for (int block = 0; block < HASH_BLOCKS; ++block) {
+        m_buckets.insert(bucketKey(perceptualHash, block), {perceptualHash, volume});
+    }
+}
+
+void PageHashIndex::updateBuckets()
+{
+    if (!m_bucketsDirty) {
+        return;
+    }
+    m_buckets.clear();
+    m_bucketVolumes.clear();
+    m_volumeHashes.clear();
+    m_sameVolumes.clear();
+    for (auto it = m_volumes.constBegin(); it != m_volumes.constEnd(); ++it) {
+        for (const auto &hashes : it.value()) {
+            addToBuckets(it.key(), hashes.perceptual);
+        }
+    }
+    m_bucketsDirty = false;
+}
+
+void PageHashIndex::load()
+{
+    if (m_loaded) {
+        return;
+    }
+    m_loaded = true;
+
+    QFile file(m_file);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    QDataStream stream(&file);
+    quint32 version = 0;
+    stream >> version;
+    if (version != FILE_VERSION) {
+        return;
+    }
+
+    qint32 volumeCount = 0;
+    stream >> volumeCount;
+    for (qint32 v = 0; v < volumeCount && stream.status() == QDataStream::Ok; ++v) {
+        QString sourceId;
+        qint32 pageCount = 0;
+        stream >> sourceId >> pageCount;
+        auto &pages = m_volumes[sourceId];
+        // saved from the least recently read volume on
+        touch(sourceId);
+        for (qint32 p = 0; p < pageCount && stream.status() == QDataStream::Ok; ++p) {
+            QString pageKey;
+            PageHashes hashes;
+            stream >> pageKey >> hashes.content >> hashes.perceptual;
+            pages.insert(pageKey, hashes);
+        }
+    }
+    removeOldVolumes();
+}
+
+void PageHashIndex::save()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_dirty) {
+        return;
+    }
+
+    QDir().mkpath(QFileInfo(m_file).absolutePath());
+    QSaveFile file(m_file);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    QDataStream stream(&file);
+    stream << FILE_VERSION << qint32(m_volumeOrder.count());
+    for (const QString &sourceId : std::as_const(m_volumeOrder)) {
+        const auto &pages = m_volumes[sourceId];
+        stream << sourceId << qint32(pages.count());
+        for (auto page = pages.constBegin(); page != pages.constEnd(); ++page) {
+            stream << page.key() << page->content << page->perceptual;
+        }
+    }
+    if (file.commit()) {
+        m_dirty = false;
+    }
+}
+
+bool PageHashIndex::skipFillerPages()
+{
+    return m_skipFillerPages;
+}
+
+void PageHashIndex::setSkipFillerPages(bool skip)
+{
+    if (skip == m_skipFillerPages) {
+        return;
+    }
+    m_skipFillerPages = skip;
+    Q_EMIT skipFillerPagesChanged();
+}
+
+#include "moc_pagehashindex.cpp"
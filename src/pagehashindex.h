@@ -0,0 +1,118 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PAGEHASHINDEX_H
+#define PAGEHASHINDEX_H
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QQmlEngine>
+#include <QTimer>
+
+#include <atomic>
+
+struct PageHashes {
+    // hash of the encoded file, equal for identical pages
+    quint64 content{0};
+    // difference hash of the page's pixels, similar for similar pages
+    quint64 perceptual{0};
+};
+
+/*
+ * Library wide, persistent index of page hashes. Used to share decoded
+ * pages between identical pages of a volume and to recognize pages,
+ * like scanlator credits or recruitment pages, that repeat across volumes.
+ * Only the most recently read volumes are kept.
+ */
+class PageHashIndex : public QObject
+{
+    Q_OBJECT
+    QML_ELEMENT
+    QML_SINGLETON
+
+    Q_PROPERTY(bool skipFillerPages READ skipFillerPages WRITE setSkipFillerPages NOTIFY skipFillerPagesChanged)
+
+public:
+    static PageHashIndex *instance();
+    static PageHashIndex *create(QQmlEngine *, QJSEngine *)
+    {
+        return instance();
+    }
+
+    /*
+     * 64 bit difference hash of a 9x8 grid of average luminances,
+     * each cell is averaged from a few samples so it takes microseconds
+     */
+    static quint64 perceptualHash(const QImage &image);
+    static quint64 contentHash(const QByteArray &data);
+
+    bool contains(const QString &sourceId, const QString &pageKey);
+    PageHashes hashes(const QString &sourceId, const QString &pageKey);
+    void insert(const QString &sourceId, const QString &pageKey, const PageHashes &hashes);
+
+    /*
+     * Returns true when pages similar to this one were seen in several other volumes
+     */
+    bool isFiller(const QString &sourceId, quint64 perceptualHash);
+
+    bool skipFillerPages();
+    void setSkipFillerPages(bool skip);
+
+    void save();
+
+Q_SIGNALS:
+    void skipFillerPagesChanged();
+
+private:
+    explicit PageHashIndex();
+    ~PageHashIndex() = default;
+    PageHashIndex(const PageHashIndex &) = delete;
+    PageHashIndex &operator=(const PageHashIndex &) = delete;
+    PageHashIndex(PageHashIndex &&) = delete;
+    PageHashIndex &operator=(PageHashIndex &&) = delete;
+
+    void load();
+    // marks the volume as the most recently read one
+    void touch(const QString &sourceId);
+    void removeOldVolumes();
+    void addToBuckets(const QString &sourceId, quint64 perceptualHash);
+    void updateBuckets();
+    // true when the volumes share most of their pages, copies of a volume count as one volume
+    bool isSameVolume(int a, int b);
+    bool hasSimilarHash(int volume, quint64 perceptualHash) const;
+
+    struct BucketEntry {
+        quint64 hash;
+        int volume;
+    };
+
+    QMutex m_mutex;
+    QString m_file;
+    bool m_loaded{false};
+    bool m_dirty{false};
+    // source id (see MangaLoader::sourceId) -> page key -> hashes
+    QHash<QString, QHash<QString, PageHashes>> m_volumes;
+    // source ids, the least recently read first
+    QStringList m_volumeOrder;
+    // perceptual hashes by blocks of their bits, for similarity lookups without scanning every hash
+    QMultiHash<quint32, BucketEntry> m_buckets;
+    QHash<QString, int> m_bucketVolumes;
+    // the hashes in the buckets by volume
+    QList<QList<quint64>> m_volumeHashes;
+    struct SameVolume {
+        qsizetype sizeA;
+        qsizetype sizeB;
+        bool same;
+    };
+    QHash<QPair<int, int>, SameVolume> m_sameVolumes;
+    bool m_bucketsDirty{true};
+    QTimer m_saveTimer;
+    std::atomic_bool m_skipFillerPages{false};
+};
+
+#endif // PAGEHASHINDEX_H
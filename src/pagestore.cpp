@@ -0,0 +1,244 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "pagestore.h"
+#include "imagescaler.h"
+#include "mangaloader.h"
+#include "pagedecoder.h"
+#include "perfstats.h"
+
+#include <QHash>
+#include <QThread>
+
+#include <algorithm>
+#include <memory>
+
+namespace
+{
+constexpr int MAXIMUM_COST_KIB = 384 * 1024;
+
+// counts a decode as queued for as long as its task exists, tasks dropped by
+// QThreadPool::clear() are deleted without running and are counted as finished too
+class QueuedDecode
+{
+public:
+    QueuedDecode()
+    {
+        PerfStats::instance()->addDecodeQueued();
+    }
+    ~QueuedDecode()
+    {
+        PerfStats::instance()->addDecodeFinished();
+    }
+    QueuedDecode(const QueuedDecode &) = delete;
+    QueuedDecode &operator=(const QueuedDecode &) = delete;
+};
+} // namespace
+
+PageStore::PageStore()
+    : QObject()
+    , m_pages(MAXIMUM_COST_KIB)
+{
+    m_threadPool.setMaxThreadCount(std::max(QThread::idealThreadCount(), 2));
+    // probing in the background replaces estimated pages, with their content hashes
+    connect(MangaLoader::instance(), &MangaLoader::imageSizesChanged, this, [this]() {
+        checkGeneration();
+        updateCanonicalIndexes();
+    });
+}
+
+PageStore *PageStore::instance()
+{
+    static PageStore *s = new PageStore();
+    return s;
+}
+
+QImage PageStore::page(int index, const QSize &size)
+{
+    checkGeneration();
+
+    index = canonicalIndex(index);
+    const PageKey key{index, size};
+    if (const QImage *image = m_pages.object(key)) {
+        PerfStats::instance()->addPageLookup(true);
+        return *image;
+    }
+    if (m_pending.contains(key)) {
+        return QImage();
+    }
+    // scaled right away so the start page shows up together with the window.
+    // Only for the first request, other sizes are decoded like any other page
+    if (index == m_startIndex && !m_startPage.isNull() && !size.isEmpty()) {
+        const QImage image = ImageScaler::scaled(m_startPage, m_startPage.size().scaled(size, Qt::KeepAspectRatio));
+        m_startPage = QImage();
+        insertPage(key, image);
+        return image;
+    }
+
+    const auto images = MangaLoader::instance()->images();
+    if (index < 0 || index >= images.count() || size.isEmpty()) {
+        return QImage();
+    }
+
+    m_pending.insert(key);
+    PerfStats::instance()->addPageLookup(false);
+    const QString path = images.at(index).path;
+    const bool grayscale = images.at(index).grayscale;
+    const quint64 contentHash = images.at(index).contentHash;
+    const int generation = m_generation;
+    auto queued = std::make_shared<QueuedDecode>();
+    m_threadPool.start([this, key, path, grayscale, contentHash, generation, queued]() mutable {
+        const QImage image = PageDecoder::decode(path, key.size, grayscale, contentHash);
+        queued.reset();
+        QMetaObject::invokeMethod(
+            this,
+            [this, key, image, generation]() {
+                if (generation != m_generation) {
+                    return;
+                }
+                m_pending.remove(key);
+                if (image.isNull()) {
+                    return;
+                }
+                insertPage(key, image);
+                Q_EMIT pageReady(key.index, key.size);
+            },
+            Qt::QueuedConnection);
+    });
+
+    return QImage();
+}
+
+QImage PageStore::closestPage(int index, const QSize &size)
+{
+    checkGeneration();
+
+    index = canonicalIndex(index);
+    QImage closest;
+    const QList<QSize> levels = m_levels.values(index);
+    for (const QSize &level : levels) {
+        const QImage *image = m_pages.object({index, level});
+        if (image == nullptr) {
+            m_levels.remove(index, level);
+            continue;
+        }
+        // the smallest level that is big enough, otherwise the biggest one
+        const bool better = closest.isNull() || (closest.width() < size.width() ? image->width() > closest.width()
+                                                                                 : image->width() >= size.width() && image->width() < closest.width());
+        if (better) {
+            closest = *image;
+        }
+    }
+    return closest;
+}
+
+int PageStore::requestRegion(int index, const QSize &size, const QRectF &region)
+{
+    checkGeneration();
+
+    index = canonicalIndex(index);
+    const int requestId = ++m_lastRegionRequest;
+    const auto images = MangaLoader::instance()->images();
+    if (index < 0 || index >= images.count() || size.isEmpty() || region.isEmpty()) {
+        return requestId;
+    }
+
+    const QString path = images.at(index).path;
+    const bool grayscale = images.at(index).grayscale;
+    const int generation = m_generation;
+    // only the last zoomed page is kept whole
+    if (index != m_regionPageIndex) {
+        m_regionPageIndex = index;
+        m_regionPage = QImage();
+    }
+    auto queued = std::make_shared<QueuedDecode>();
+    // the region is on screen, it goes before pages decoded ahead of time
+    m_threadPool.start(
+        [this, requestId, index, path, size, region, grayscale, generation, queued, fullPage = m_regionPage]() mutable {
+            QRectF coveredRegion;
+            const bool hadFullPage = !fullPage.isNull();
+            const QImage image = PageDecoder::decodeRegion(path, size, region, grayscale, &coveredRegion, &fullPage);
+            queued.reset();
+            QMetaObject::invokeMethod(
+                this,
+                [this, requestId, index, coveredRegion, image, generation, fullPage = hadFullPage ? QImage() : fullPage]() {
+                    if (generation != m_generation) {
+                        return;
+                    }
+                    if (!fullPage.isNull() && index == m_regionPageIndex) {
+                        m_regionPage = fullPage;
+                    }
+                    if (image.isNull()) {
+                        return;
+                    }
+                    Q_EMIT regionReady(requestId, coveredRegion, image);
+                },
+                Qt::QueuedConnection);
+        },
+        1);
+
+    return requestId;
+}
+
+qint64 PageStore::usedBytes() const
+{
+    return qint64(m_pages.totalCost()) * 1024 + m_regionPage.sizeInBytes();
+}
+
+int PageStore::canonicalIndex(int index)
+{
+    checkGeneration();
+    if (index < 0 || index >= m_canonicalIndexes.count()) {
+        return index;
+    }
+    return m_canonicalIndexes.at(index);
+}
+
+void PageStore::checkGeneration()
+{
+    const int generation = MangaLoader::instance()->generation();
+    if (generation == m_generation) {
+        return;
+    }
+    // a new volume was loaded, the indexes now point to different pages
+    m_generation = generation;
+    m_pages.clear();
+    m_levels.clear();
+    m_pending.clear();
+    m_regionPageIndex = -1;
+    m_regionPage = QImage();
+    m_threadPool.clear();
+    m_startPage = MangaLoader::instance()->takeStartPage();
+    updateCanonicalIndexes();
+}
+
+void PageStore::updateCanonicalIndexes()
+{
+    const auto images = MangaLoader::instance()->images();
+    QHash<quint64, int> firstIndexes;
+    m_canonicalIndexes.clear();
+    m_canonicalIndexes.reserve(images.count());
+    for (int i = 0; i < images.count(); ++i) {
+        const quint64 hash = images.at(i).contentHash;
+        if (hash == 0) {
+            m_canonicalIndexes.append(i);
+            continue;
+        }
+        m_canonicalIndexes.append(firstIndexes.value(hash, i));
+        firstIndexes.insert(hash, m_canonicalIndexes.last());
+    }
+    m_startIndex = canonicalIndex(MangaLoader::instance()->startIndex());
+}
+
+void PageStore::insertPage(const PageKey &key, const QImage &image)
+{
+    if (!m_levels.contains(key.index, key.size)) {
+        m_levels.insert(key.index, key.size);
+    }
+    m_pages.insert(key, new QImage(image), std::max<qsizetype>(image.sizeInBytes() / 1024, 1));
+}
+
+#include "moc_pagestore.cpp"
@@ -0,0 +1,100 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PAGESTORE_H
+#define PAGESTORE_H
+
+#include <QCache>
+#include <QImage>
+#include <QList>
+#include <QMultiHash>
+#include <QObject>
+#include <QSet>
+#include <QThreadPool>
+
+struct PageKey {
+    int index;
+    QSize size;
+
+    bool operator==(const PageKey &other) const = default;
+};
+
+inline size_t qHash(const PageKey &key, size_t seed = 0)
+{
+    return qHashMulti(seed, key.index, key.size.width(), key.size.height());
+}
+
+/*
+ * In memory store of the decoded pages of the current volume,
+ * pages are decoded on a thread pool and kept until the memory limit is reached.
+ * Only used from the gui thread
+ */
+class PageStore : public QObject
+{
+    Q_OBJECT
+public:
+    static PageStore *instance();
+
+    /*
+     * Returns the page if it was already decoded at this size, otherwise
+     * a null image is returned and pageReady is emitted once the page is decoded
+     */
+    QImage page(int index, const QSize &size);
+    /*
+     * Returns the already decoded size of the page that is closest to `size`, without decoding anything.
+     * Used while zooming, the page is scaled on the gpu until the zoom settles
+     */
+    QImage closestPage(int index, const QSize &size);
+    /*
+     * Decodes only `region` (in 0-1 page coordinates) of the page, at the resolution it has when the
+     * whole page is shown at `size`. For zoomed in pages that would be too big to decode whole.
+     * Returns an id that regionReady is emitted with
+     */
+    int requestRegion(int index, const QSize &size, const QRectF &region);
+    /*
+     * Identical pages of a volume share their decoded image, this returns
+     * the index of the first page identical to `index`, which is the one
+     * pageReady is emitted for
+     */
+    int canonicalIndex(int index);
+    // size of the decoded pages kept in memory
+    qint64 usedBytes() const;
+
+Q_SIGNALS:
+    void pageReady(int index, const QSize &size);
+    // `region` is the part of the page the image covers, it can be slightly bigger than requested
+    void regionReady(int requestId, const QRectF &region, const QImage &image);
+
+private:
+    explicit PageStore();
+    ~PageStore() = default;
+    PageStore(const PageStore &) = delete;
+    PageStore &operator=(const PageStore &) = delete;
+    PageStore(PageStore &&) = delete;
+    PageStore &operator=(PageStore &&) = delete;
+
+    void checkGeneration();
+    void updateCanonicalIndexes();
+    void insertPage(const PageKey &key, const QImage &image);
+
+    // cost is in KiB
+    QCache<PageKey, QImage> m_pages;
+    QSet<PageKey> m_pending;
+    // sizes each page was decoded at, some of them may have been evicted from m_pages since
+    QMultiHash<int, QSize> m_levels;
+    int m_lastRegionRequest{0};
+    // the whole page regions are cropped from, for formats that can't decode just a region
+    int m_regionPageIndex{-1};
+    QImage m_regionPage;
+    QList<int> m_canonicalIndexes;
+    // full resolution start page decoded while the volume was opened
+    QImage m_startPage;
+    int m_startIndex{0};
+    QThreadPool m_threadPool;
+    int m_generation{-1};
+};
+
+#endif // PAGESTORE_H
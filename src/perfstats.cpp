@@ -0,0 +1,285 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "perfstats.h"
+#include "pagecache.h"
+#include "pagestore.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QQuickWindow>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+
+using namespace Qt::StringLiterals;
+
+namespace
+{
+constexpr qsizetype MAXIMUM_SAMPLES = 1024;
+// upper bounds of the frame time histogram buckets in milliseconds, the last bucket has no bound
+constexpr std::array<double, 9> FRAME_BUCKETS{4, 8, 12, 16.7, 20, 25, 33.4, 50, 100};
+// nothing is rendered while nothing changes, longer gaps are idle time and not slow frames
+constexpr qint64 MAXIMUM_FRAME_GAP = 250'000'000;
+constexpr int SUMMARY_INTERVAL = 500;
+
+double milliseconds(qint64 nanoseconds)
+{
+    return nanoseconds / 1'000'000.0;
+}
+
+QString ratio(qint64 hits, qint64 misses)
+{
+    if (hits + misses == 0) {
+        return u"-"_s;
+    }
+    return u"%1%"_s.arg(qRound(100.0 * hits / (hits + misses)));
+}
+
+QString mebibytes(qint64 bytes)
+{
+    return u"%1 MiB"_s.arg(bytes / (1024.0 * 1024.0), 0, 'f', 1);
+}
+} // namespace
+
+PerfStats::PerfStats()
+    : QObject()
+    , m_frameHistogram(FRAME_BUCKETS.size() + 1, 0)
+{
+    // moved to the gui thread along with the stats
+    m_summaryTimer.setParent(this);
+    m_summaryTimer.setInterval(SUMMARY_INTERVAL);
+    connect(&m_summaryTimer, &QTimer::timeout, this, &PerfStats::summaryChanged);
+}
+
+PerfStats *PerfStats::instance()
+{
+    static PerfStats *s = []() {
+        auto *stats = new PerfStats();
+        // instance() can be called first from a decoding or preloading thread, the summary timer needs the gui thread
+        stats->moveToThread(QCoreApplication::instance()->thread());
+        return stats;
+    }();
+    return s;
+}
+
+void PerfStats::Samples::add(qint64 value)
+{
+    if (values.size() < MAXIMUM_SAMPLES) {
+        values.append(value);
+    } else {
+        values[next] = value;
+    }
+    next = (next + 1) % MAXIMUM_SAMPLES;
+    ++count;
+}
+
+qint64 PerfStats::Samples::percentile(int percent) const
+{
+    if (values.isEmpty()) {
+        return 0;
+    }
+    QList<qint64> sorted = values;
+    const qsizetype index = std::min<qsizetype>(sorted.size() * percent / 100, sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted.at(index);
+}
+
+void PerfStats::watchWindow(QQuickWindow *window)
+{
+    connect(window, &QQuickWindow::frameSwapped, this, &PerfStats::addFrame, Qt::DirectConnection);
+}
+
+void PerfStats::addFrame()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_frameTimer.isValid()) {
+        m_frameTimer.start();
+        return;
+    }
+    const qint64 elapsed = m_frameTimer.nsecsElapsed();
+    m_frameTimer.restart();
+    if (elapsed > MAXIMUM_FRAME_GAP) {
+        return;
+    }
+
+    const double elapsedMilliseconds = milliseconds(elapsed);
+    const auto bucket = std::lower_bound(FRAME_BUCKETS.cbegin(), FRAME_BUCKETS.cend(), elapsedMilliseconds);
+    ++m_frameHistogram[std::distance(FRAME_BUCKETS.cbegin(), bucket)];
+    m_frameTimes.add(elapsed);
+}
+
+void PerfStats::addDecode(const QByteArray &format, qint64 nanoseconds)
+{
+    QMutexLocker locker(&m_mutex);
+    m_decodeTimes[format.isEmpty() ? QByteArrayLiteral("unknown") : format].add(nanoseconds);
+}
+
+void PerfStats::addDecodeQueued()
+{
+    QMutexLocker locker(&m_mutex);
+    ++m_decodeQueue;
+    m_maximumDecodeQueue = std::max(m_decodeQueue, m_maximumDecodeQueue);
+}
+
+void PerfStats::addDecodeFinished()
+{
+    QMutexLocker locker(&m_mutex);
+    --m_decodeQueue;
+}
+
+void PerfStats::addPageLookup(bool hit)
+{
+    QMutexLocker locker(&m_mutex);
+    ++(hit ? m_pageHits : m_pageMisses);
+}
+
+void PerfStats::addDiskCacheLookup(bool hit)
+{
+    QMutexLocker locker(&m_mutex);
+    ++(hit ? m_diskCacheHits : m_diskCacheMisses);
+}
+
+void PerfStats::addArchiveRead(qint64 bytes, qint64 nanoseconds)
+{
+    QMutexLocker locker(&m_mutex);
+    m_archiveBytes += bytes;
+    m_archiveNanoseconds += nanoseconds;
+}
+
+void PerfStats::addOpenPhase(const QString &phase, qint64 milliseconds)
+{
+    QMutexLocker locker(&m_mutex);
+    m_openPhases.append({phase, milliseconds});
+}
+
+void PerfStats::resetOpenPhases()
+{
+    QMutexLocker locker(&m_mutex);
+    m_openPhases.clear();
+}
+
+bool PerfStats::active() const
+{
+    return m_active;
+}
+
+void PerfStats::setActive(bool active)
+{
+    if (active == m_active) {
+        return;
+    }
+    m_active = active;
+    if (m_active) {
+        m_summaryTimer.start();
+        Q_EMIT summaryChanged();
+    } else {
+        m_summaryTimer.stop();
+    }
+    Q_EMIT activeChanged();
+}
+
+QString PerfStats::summary()
+{
+    // the page store is only used from the gui thread, ask before locking
+    const qint64 pageStoreBytes = PageStore::instance()->usedBytes();
+    const qint64 diskCacheBytes = PageCache::instance()->usedBytes();
+
+    QMutexLocker locker(&m_mutex);
+    QStringList lines;
+    const qint64 frames = m_frameTimes.count;
+    const qint64 slowFrames = frames - std::accumulate(m_frameHistogram.cbegin(), m_frameHistogram.cbegin() + 4, qint64(0));
+    lines.append(u"frames: %1, p50 %2 ms, p99 %3 ms, slower than 60 fps %4"_s.arg(frames)
+                     .arg(milliseconds(m_frameTimes.percentile(50)), 0, 'f', 1)
+                     .arg(milliseconds(m_frameTimes.percentile(99)), 0, 'f', 1)
+                     .arg(ratio(slowFrames, frames - slowFrames)));
+    lines.append(u"decode queue: %1 (max %2)"_s.arg(m_decodeQueue).arg(m_maximumDecodeQueue));
+    for (auto it = m_decodeTimes.cbegin(); it != m_decodeTimes.cend(); ++it) {
+        lines.append(u"%1: %2 decodes, p50 %3 ms, p90 %4 ms, p99 %5 ms"_s.arg(QString::fromLatin1(it.key()))
+                         .arg(it->count)
+                         .arg(milliseconds(it->percentile(50)), 0, 'f', 1)
+                         .arg(milliseconds(it->percentile(90)), 0, 'f', 1)
+                         .arg(milliseconds(it->percentile(99)), 0, 'f', 1));
+    }
+    lines.append(u"page store: %1 hits, %2"_s.arg(ratio(m_pageHits, m_pageMisses), mebibytes(pageStoreBytes)));
+    lines.append(u"disk cache: %1 hits, %2"_s.arg(ratio(m_diskCacheHits, m_diskCacheMisses), mebibytes(std::max<qint64>(diskCacheBytes, 0))));
+    const double seconds = m_archiveNanoseconds / 1'000'000'000.0;
+    lines.append(u"archive reads: %1 at %2/s"_s.arg(mebibytes(m_archiveBytes), seconds > 0 ? mebibytes(m_archiveBytes / seconds) : u"-"_s));
+    for (const auto &[phase, time] : std::as_const(m_openPhases)) {
+        lines.append(u"%1: %2 ms"_s.arg(phase).arg(time));
+    }
+    return lines.join(u'\n');
+}
+
+QJsonObject PerfStats::toJson()
+{
+    const qint64 pageStoreBytes = PageStore::instance()->usedBytes();
+    const qint64 diskCacheBytes = PageCache::instance()->usedBytes();
+
+    QMutexLocker locker(&m_mutex);
+    auto percentiles = [](const Samples &samples) {
+        return QJsonObject{
+            {u"count"_s, samples.count},
+            {u"p50"_s, milliseconds(samples.percentile(50))},
+            {u"p90"_s, milliseconds(samples.percentile(90))},
+            {u"p99"_s, milliseconds(samples.percentile(99))},
+        };
+    };
+
+    QJsonArray histogram;
+    for (qsizetype i = 0; i < m_frameHistogram.size(); ++i) {
+        histogram.append(QJsonObject{
+            {u"upTo"_s, i < qsizetype(FRAME_BUCKETS.size()) ? QJsonValue(FRAME_BUCKETS.at(i)) : QJsonValue()},
+            {u"frames"_s, m_frameHistogram.at(i)},
+        });
+    }
+    QJsonObject frames = percentiles(m_frameTimes);
+    frames.insert(u"histogram"_s, histogram);
+
+    QJsonObject decodes;
+    for (auto it = m_decodeTimes.cbegin(); it != m_decodeTimes.cend(); ++it) {
+        decodes.insert(QString::fromLatin1(it.key()), percentiles(it.value()));
+    }
+
+    QJsonArray openPhases;
+    for (const auto &[phase, time] : std::as_const(m_openPhases)) {
+        openPhases.append(QJsonObject{{u"phase"_s, phase}, {u"milliseconds"_s, time}});
+    }
+
+    return QJsonObject{
+        {u"time"_s, QDateTime::currentDateTime().toString(Qt::ISODate)},
+        {u"frames"_s, frames},
+        {u"decodeQueue"_s, QJsonObject{{u"current"_s, m_decodeQueue}, {u"maximum"_s, m_maximumDecodeQueue}}},
+        {u"decodes"_s, decodes},
+        {u"pageStore"_s, QJsonObject{{u"hits"_s, m_pageHits}, {u"misses"_s, m_pageMisses}, {u"bytes"_s, pageStoreBytes}}},
+        {u"diskCache"_s, QJsonObject{{u"hits"_s, m_diskCacheHits}, {u"misses"_s, m_diskCacheMisses}, {u"bytes"_s, diskCacheBytes}}},
+        {u"archiveReads"_s, QJsonObject{{u"bytes"_s, m_archiveBytes}, {u"milliseconds"_s, milliseconds(m_archiveNanoseconds)}}},
+        {u"openPhases"_s, openPhases},
+    };
+}
+
+QString PerfStats::dump()
+{
+    const QString folder = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!QDir().mkpath(folder)) {
+        return QString();
+    }
+    const QString path = folder + u"/stats-%1.json"_s.arg(QDateTime::currentDateTime().toString(u"yyyyMMdd-hhmmss"_s));
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return QString();
+    }
+    file.write(QJsonDocument(toJson()).toJson());
+    return file.commit() ? path : QString();
+}
+
+#include "moc_perfstats.cpp"
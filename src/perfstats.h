@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PERFSTATS_H
+#define PERFSTATS_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QQmlEngine>
+#include <QTimer>
+
+class QQuickWindow;
+
+/*
+ * Performance numbers shown by the stats overlay and saved with dump(), so
+ * reports about stuttering come with something to look at: frame times,
+ * decode latencies, cache hits, archive reads and how long opening took.
+ * The add* functions can be called from any thread
+ */
+class PerfStats : public QObject
+{
+    Q_OBJECT
+    QML_ELEMENT
+    QML_SINGLETON
+
+    // the summary is only updated while something shows it
+    Q_PROPERTY(bool active READ active WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(QString summary READ summary NOTIFY summaryChanged)
+
+public:
+    static PerfStats *instance();
+    static PerfStats *create(QQmlEngine *, QJSEngine *)
+    {
+        return instance();
+    }
+
+    // frame times are taken from the window's swaps, on the render thread
+    void watchWindow(QQuickWindow *window);
+
+    void addDecode(const QByteArray &format, qint64 nanoseconds);
+    void addDecodeQueued();
+    void addDecodeFinished();
+    // lookups in the PageStore, in memory
+    void addPageLookup(bool hit);
+    // lookups in the PageCache, on disk
+    void addDiskCacheLookup(bool hit);
+    void addArchiveRead(qint64 bytes, qint64 nanoseconds);
+    // time since the volume started opening, the phases of the previous volume are dropped by resetOpenPhases()
+    void addOpenPhase(const QString &phase, qint64 milliseconds);
+    void resetOpenPhases();
+
+    bool active() const;
+    void setActive(bool active);
+
+    QString summary();
+    Q_INVOKABLE QJsonObject toJson();
+    /*
+     * Saves toJson() to a file in the app data folder,
+     * returns the path of the file or an empty string on failure
+     */
+    Q_INVOKABLE QString dump();
+
+Q_SIGNALS:
+    void activeChanged();
+    void summaryChanged();
+
+private:
+    explicit PerfStats();
+    ~PerfStats() = default;
+    PerfStats(const PerfStats &) = delete;
+    PerfStats &operator=(const PerfStats &) = delete;
+    PerfStats(PerfStats &&) = delete;
+    PerfStats &operator=(PerfStats &&) = delete;
+
+    // the most recent samples, older ones are overwritten
+    struct Samples {
+        void add(qint64 value);
+        qint64 percentile(int percent) const;
+
+        QList<qint64> values;
+        qsizetype next{0};
+        qint64 count{0};
+    };
+
+    void addFrame();
+
+    mutable QMutex m_mutex;
+    QElapsedTimer m_frameTimer;
+    QList<qint64> m_frameHistogram;
+    Samples m_frameTimes;
+    QHash<QByteArray, Samples> m_decodeTimes;
+    int m_decodeQueue{0};
+    int m_maximumDecodeQueue{0};
+    qint64 m_pageHits{0};
+    qint64 m_pageMisses{0};
+    qint64 m_diskCacheHits{0};
+    qint64 m_diskCacheMisses{0};
+    qint64 m_archiveBytes{0};
+    qint64 m_archiveNanoseconds{0};
+    QList<QPair<QString, qint64>> m_openPhases;
+    bool m_active{false};
+    QTimer m_summaryTimer;
+};
+
+#endif // PERFSTATS_H
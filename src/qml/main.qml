@@ -26,7 +26,10 @@ Window {
     property int scrollStepSize: 150
     property bool upscaleImages: true
     property bool showScrollBar: true
-
+    property bool diskCacheEnabled: true
+    property int diskCacheSize: 1024
+    property bool skipFillerPages: false
+    property bool showPerformanceStats: false
 
     title: file
     visible: true
@@ -46,10 +49,75 @@ Window {
         property alias upscaleImages: window.upscaleImages
         property alias scrollStepSize: window.scrollStepSize
         property alias showScrollBar: window.showScrollBar
+        property alias diskCacheEnabled: window.diskCacheEnabled
+        property alias diskCacheSize: window.diskCacheSize
+        property alias skipFillerPages: window.skipFillerPages
         property alias fileDialogLocation: window.fileDialogLocation
         property alias folderDialogLocation: window.folderDialogLocation
     }
 
+    Binding {
+        target: PageCache
+        property: "enabled"
+        value: window.diskCacheEnabled
+    }
+
+    Binding {
+        target: PageCache
+        property: "maximumSize"
+        value: window.diskCacheSize
+    }
+
+    Binding {
+        target: PageHashIndex
+        property: "skipFillerPages"
+        value: window.skipFillerPages
+    }
+
+    Binding {
+        target: PerfStats
+        property: "active"
+        value: window.showPerformanceStats
+    }
+
+    Rectangle {
+        z: 90
+        visible: window.showPerformanceStats
+        anchors.top: parent.top
+        anchors.right: parent.right
+        anchors.margins: 10
+        width: statsLayout.implicitWidth + 20
+        height: statsLayout.implicitHeight + 20
+        color: Qt.rgba(0, 0, 0, 0.75)
+        radius: 4
+
+        ColumnLayout {
+            id: statsLayout
+
+            anchors.centerIn: parent
+
+            Label {
+                text: PerfStats.summary
+                color: "white"
+                font.family: "monospace"
+            }
+            RowLayout {
+                Button {
+                    text: "Save stats"
+                    onClicked: {
+                        const path = PerfStats.dump()
+                        savedStatsLabel.text = path !== "" ? "Saved to " + path : "Could not save the stats"
+                    }
+                }
+                Label {
+                    id: savedStatsLabel
+
+                    color: "white"
+                }
+            }
+        }
+    }
+
     Item {
         z: 50
         anchors.fill: parent
@@ -143,6 +211,49 @@ Window {
                         onValueChanged: settings.scrollStepSize = value
                     }
                 }
+                RowLayout {
+                    Label {
+                        text: "Cache pages on disk"
+                    }
+                    CheckBox {
+                        checked: settings.diskCacheEnabled
+                        onCheckedChanged: settings.diskCacheEnabled = checked
+                    }
+                }
+                RowLayout {
+                    Label {
+                        text: "Disk cache size (MiB)"
+                    }
+                    SpinBox {
+                        from: 64
+                        to: 65536
+                        stepSize: 64
+                        value: settings.diskCacheSize
+                        onValueChanged: settings.diskCacheSize = value
+                    }
+                    Button {
+                        text: "Clear"
+                        onClicked: PageCache.clear()
+                    }
+                }
+                RowLayout {
+                    Label {
+                        text: "Skip filler pages seen in other volumes"
+                    }
+                    CheckBox {
+                        checked: settings.skipFillerPages
+                        onCheckedChanged: settings.skipFillerPages = checked
+                    }
+                }
+                RowLayout {
+                    Label {
+                        text: "Show performance stats (F12)"
+                    }
+                    CheckBox {
+                        checked: window.showPerformanceStats
+                        onCheckedChanged: window.showPerformanceStats = checked
+                    }
+                }
             }
         }
     }
@@ -156,39 +267,60 @@ Window {
         sourceComponent: ListView {
                 id: view
 
+                // pinch and ctrl+wheel, pages are only decoded again once zooming stops
+                property real zoom: 1.0
+                readonly property bool zooming: pinchHandler.active || zoomSettleTimer.running
+                // the page a volume was left at, the view can only be positioned once it's complete
+                property int pendingStartIndex: -1
+                property bool completed: false
+                // the page at the top of the view and where it was before pages changed size
+                property int anchorIndex: -1
+                property real anchorY: 0
+
                 anchors.fill: parent
                 anchors.rightMargin: window.showScrollBar ? ScrollBar.vertical.width : 0
                 model: MangaImagesModel {
                     id: mangaImagesModel
 
                     path: window.file
+                    onUpdated: {
+                        view.pendingStartIndex = MangaLoader.startIndex
+                        view.positionAtStart()
+                    }
+                    onSizesAboutToChange: view.rememberAnchor()
+                    onSizesChanged: view.restoreAnchor()
+                }
+                onContentYChanged: readingPositionTimer.restart()
+                Component.onCompleted: {
+                    completed = true
+                    positionAtStart()
                 }
                 spacing: window.imageSpacing
+                cacheBuffer: height
                 reuseItems: true
                 transformOrigin: Item.Top
                 boundsBehavior: Flickable.StopAtBounds
                 flickableDirection: Flickable.HorizontalAndVerticalFlick
+                contentWidth: Math.max(width, Math.min(width, window.maximumImageWidth) * zoom)
                 delegate: Item {
                     id: delegate
 
-                    height: img.height
-                    width: Math.max(view.width, img.width)
+                    height: page.height
+                    width: Math.max(view.contentWidth, page.width)
 
-                    Image {
-                        id: img
+                    MangaPage {
+                        id: page
 
                         property int originalWidth: model.width
                         property int originalHeight: model.height
 
                         anchors.centerIn: parent
 
-                        source: "image://manga/" + model.path
+                        pageIndex: model.index
+                        zoom: view.zoom
+                        zooming: view.zooming
                         width: view.scaledWidth(Qt.size(originalWidth, originalHeight))
                         height: view.scaledHeight(Qt.size(originalWidth, originalHeight))
-                        sourceSize.width: width
-                        sourceSize.height: height
-                        asynchronous: true
-                        cache: false
                     }
                 }
 
@@ -204,6 +336,49 @@ Window {
 
                     target: view
                     verticalStepSize: window.scrollStepSize
+                    onWheel: (wheel) => {
+                        if (!(wheel.modifiers & Qt.ControlModifier)) {
+                            return
+                        }
+                        // 120 is one notch of a mouse wheel
+                        view.zoomAt(view.zoom * Math.pow(1.2, wheel.angleDelta.y / 120), Qt.point(wheel.x, wheel.y))
+                        zoomSettleTimer.restart()
+                        wheel.accepted = true
+                    }
+                }
+
+                PinchHandler {
+                    id: pinchHandler
+
+                    property real startZoom: 1.0
+
+                    target: null
+                    onActiveChanged: {
+                        if (active) {
+                            startZoom = view.zoom
+                        }
+                    }
+                    onActiveScaleChanged: {
+                        view.zoomAt(startZoom * activeScale, view.mapFromItem(null, centroid.scenePosition))
+                    }
+                }
+
+                Timer {
+                    id: zoomSettleTimer
+
+                    interval: 250
+                }
+
+                Timer {
+                    id: readingPositionTimer
+
+                    interval: 500
+                    onTriggered: {
+                        const index = view.indexAt(view.contentX + view.width / 2, view.contentY + view.height / 3)
+                        if (index >= 0) {
+                            MangaLoader.saveReadingPosition(index)
+                        }
+                    }
                 }
 
                 TapHandler {
@@ -235,13 +410,63 @@ Window {
                 function scaledWidth(size) {
                     let ratio = calculateRatio(size)
 
-                    return size.width * ratio
+                    return size.width * ratio * view.zoom
                 }
 
                 function scaledHeight(size) {
                     let ratio = calculateRatio(size)
 
-                    return size.height * ratio
+                    return size.height * ratio * view.zoom
+                }
+
+                function positionAtStart() {
+                    if (!view.completed || view.pendingStartIndex < 0) {
+                        return
+                    }
+                    view.positionViewAtIndex(view.pendingStartIndex, ListView.Beginning)
+                    view.pendingStartIndex = -1
+                }
+
+                function rememberAnchor() {
+                    view.anchorIndex = -1
+                    if (view.pendingStartIndex >= 0) {
+                        return
+                    }
+                    const index = view.indexAt(view.contentX + view.width / 2, view.contentY + view.spacing)
+                    const item = view.itemAtIndex(index)
+                    if (item) {
+                        view.anchorIndex = index
+                        view.anchorY = item.y
+                    }
+                }
+
+                // pages above the view that got their real size would otherwise push it down,
+                // only created delegates are laid out so only they can move it
+                function restoreAnchor() {
+                    if (view.anchorIndex < 0) {
+                        return
+                    }
+                    view.forceLayout()
+                    const item = view.itemAtIndex(view.anchorIndex)
+                    if (item && item.y !== view.anchorY) {
+                        view.contentY += item.y - view.anchorY
+                    }
+                    view.anchorIndex = -1
+                }
+
+                // keeps the content under `point` (in view coordinates) in place
+                function zoomAt(newZoom, point) {
+                    newZoom = Math.min(Math.max(newZoom, 0.25), 8)
+                    const factor = newZoom / view.zoom
+                    if (factor === 1) {
+                        return
+                    }
+                    const contentPointX = view.contentX + point.x
+                    const contentPointY = view.contentY - view.originY + point.y
+                    view.zoom = newZoom
+                    view.contentX = Math.max(0, Math.min(contentPointX * factor - point.x, view.contentWidth - view.width))
+                    view.contentY = view.originY + contentPointY * factor - point.y
+                    view.returnToBounds()
                 }
 
             } // ListView
@@ -282,6 +507,11 @@ Window {
         onActivated: folderDialog.open()
     }
 
+    Shortcut {
+        sequence: "F12"
+        onActivated: window.showPerformanceStats = !window.showPerformanceStats
+    }
+
     function isFullScreen() {
         return window.visibility === Window.FullScreen
     }
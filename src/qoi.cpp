@@ -0,0 +1,193 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "qoi.h"
+
+#include <QtEndian>
+
+namespace
+{
+constexpr uchar OP_INDEX = 0x00;
+constexpr uchar OP_DIFF = 0x40;
+constexpr uchar OP_LUMA = 0x80;
+constexpr uchar OP_RUN = 0xc0;
+constexpr uchar OP_RGB = 0xfe;
+constexpr uchar OP_RGBA = 0xff;
+constexpr uchar MASK_2 = 0xc0;
+constexpr int HEADER_SIZE = 14;
+constexpr uchar PADDING[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+// refuse to allocate more than 400 megapixels for a corrupt header
+constexpr quint64 MAX_PIXELS = 400'000'000;
+
+struct Rgba {
+    uchar r{0};
+    uchar g{0};
+    uchar b{0};
+    uchar a{0};
+
+    bool operator==(const Rgba &other) const = default;
+};
+
+inline int colorHash(const Rgba &px)
+{
+    return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+}
+} // namespace
+
+PooledBuffer Qoi::encode(const QImage &image)
+{
+    if (image.isNull()) {
+        return PooledBuffer();
+    }
+
+    const bool hasAlpha = image.hasAlphaChannel();
+    const QImage src = image.convertToFormat(hasAlpha ? QImage::Format_RGBA8888 : QImage::Format_RGBX8888);
+    const int width = src.width();
+    const int height = src.height();
+
+    // worst case is one OP_RGBA (5 bytes) per pixel
+    PooledBuffer data(HEADER_SIZE + qsizetype(width) * height * 5 + sizeof(PADDING));
+    auto *out = reinterpret_cast<uchar *>(data.data());
+    qsizetype p = 0;
+
+    memcpy(out, "qoif", 4);
+    qToBigEndian<quint32>(width, out + 4);
+    qToBigEndian<quint32>(height, out + 8);
+    out[12] = hasAlpha ? 4 : 3;
+    out[13] = 0;
+    p += HEADER_SIZE;
+
+    Rgba index[64] = {};
+    Rgba prev{0, 0, 0, 255};
+    int run = 0;
+    for (int y = 0; y < height; ++y) {
+        const uchar *line = src.constScanLine(y);
+        for (int x = 0; x < width; ++x) {
+            const Rgba px{line[x * 4], line[x * 4 + 1], line[x * 4 + 2], line[x * 4 + 3]};
+            const bool last = y == height - 1 && x == width - 1;
+
+            if (px == prev) {
+                ++run;
+                if (run == 62 || last) {
+                    out[p++] = OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                out[p++] = OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            const int hash = colorHash(px);
+            if (index[hash] == px) {
+                out[p++] = OP_INDEX | hash;
+            } else {
+                index[hash] = px;
+                if (px.a == prev.a) {
+                    const auto vr = static_cast<signed char>(px.r - prev.r);
+                    const auto vg = static_cast<signed char>(px.g - prev.g);
+                    const auto vb = static_cast<signed char>(px.b - prev.b);
+                    const int vgr = vr - vg;
+                    const int vgb = vb - vg;
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        out[p++] = OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                        out[p++] = OP_LUMA | (vg + 32);
+                        out[p++] = (vgr + 8) << 4 | (vgb + 8);
+                    } else {
+                        out[p++] = OP_RGB;
+                        out[p++] = px.r;
+                        out[p++] = px.g;
+                        out[p++] = px.b;
+                    }
+                } else {
+                    out[p++] = OP_RGBA;
+                    out[p++] = px.r;
+                    out[p++] = px.g;
+                    out[p++] = px.b;
+                    out[p++] = px.a;
+                }
+            }
+            prev = px;
+        }
+    }
+
+    memcpy(out + p, PADDING, sizeof(PADDING));
+    p += sizeof(PADDING);
+    data.truncate(p);
+
+    return data;
+}
+
+QImage Qoi::decode(const QByteArray &data)
+{
+    if (data.size() < HEADER_SIZE + qsizetype(sizeof(PADDING)) || !data.startsWith("qoif")) {
+        return QImage();
+    }
+
+    const auto *in = reinterpret_cast<const uchar *>(data.constData());
+    const quint32 width = qFromBigEndian<quint32>(in + 4);
+    const quint32 height = qFromBigEndian<quint32>(in + 8);
+    const uchar channels = in[12];
+    if (width == 0 || height == 0 || quint64(width) * height > MAX_PIXELS || (channels != 3 && channels != 4)) {
+        return QImage();
+    }
+
+    QImage image = BufferPool::instance()->image(QSize(width, height), channels == 4 ? QImage::Format_RGBA8888 : QImage::Format_RGBX8888);
+    if (image.isNull()) {
+        return QImage();
+    }
+
+    const qsizetype chunksEnd = data.size() - sizeof(PADDING);
+    qsizetype p = HEADER_SIZE;
+    Rgba index[64] = {};
+    Rgba px{0, 0, 0, 255};
+    int run = 0;
+    for (quint32 y = 0; y < height; ++y) {
+        uchar *line = image.scanLine(y);
+        for (quint32 x = 0; x < width; ++x) {
+            if (run > 0) {
+                --run;
+            } else if (p < chunksEnd) {
+                const uchar b1 = in[p++];
+                if (b1 == OP_RGB) {
+                    px.r = in[p++];
+                    px.g = in[p++];
+                    px.b = in[p++];
+                } else if (b1 == OP_RGBA) {
+                    px.r = in[p++];
+                    px.g = in[p++];
+                    px.b = in[p++];
+                    px.a = in[p++];
+                } else if ((b1 & MASK_2) == OP_INDEX) {
+                    px = index[b1];
+                } else if ((b1 & MASK_2) == OP_DIFF) {
+                    px.r += ((b1 >> 4) & 0x03) - 2;
+                    px.g += ((b1 >> 2) & 0x03) - 2;
+                    px.b += (b1 & 0x03) - 2;
+                } else if ((b1 & MASK_2) == OP_LUMA) {
+                    const uchar b2 = in[p++];
+                    const int vg = (b1 & 0x3f) - 32;
+                    px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px.g += vg;
+                    px.b += vg - 8 + (b2 & 0x0f);
+                } else if ((b1 & MASK_2) == OP_RUN) {
+                    run = (b1 & 0x3f);
+                }
+                index[colorHash(px)] = px;
+            }
+
+            line[x * 4] = px.r;
+            line[x * 4 + 1] = px.g;
+            line[x * 4 + 2] = px.b;
+            line[x * 4 + 3] = px.a;
+        }
+    }
+
+    return image;
+}
@@ -0,0 +1,26 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef QOI_H
+#define QOI_H
+
+#include <QByteArray>
+#include <QImage>
+
+#include "bufferpool.h"
+
+/*
+ * Minimal encoder/decoder for the "Quite OK Image" format (https://qoiformat.org).
+ * It is used for the on-disk page cache because it decodes several times
+ * faster than png/webp while still compressing flat manga pages well.
+ */
+namespace Qoi
+{
+PooledBuffer encode(const QImage &image);
+QImage decode(const QByteArray &data);
+}
+
+#endif // QOI_H
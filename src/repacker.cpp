@@ -0,0 +1,244 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "repacker.h"
+
+#include <QBuffer>
+#include <QCollator>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QProcess>
+#include <QSet>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QThreadPool>
+
+#include <KArchive>
+#include <KZip>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+
+#include "extractor.h"
+#include "repackindex.h"
+
+using namespace Qt::StringLiterals;
+
+namespace
+{
+constexpr qint64 LOCAL_HEADER_SIZE = 30;
+// jpeg compression leaves some color noise on gray pages
+constexpr int GRAYSCALE_TOLERANCE = 8;
+
+// the pages of a volume in reading order
+struct Source {
+    std::unique_ptr<KArchive> archive;
+    std::unique_ptr<QTemporaryDir> extractionFolder;
+    QString folder;
+    QStringList pages;
+};
+
+QStringList folderFiles(const QString &folder)
+{
+    QStringList files;
+    QDirIterator it(folder, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        files.append(QDir(folder).relativeFilePath(it.next()));
+    }
+    return files;
+}
+
+bool openSource(const QString &path, Source *source)
+{
+    const QFileInfo fileInfo(path);
+    Extractor extractor;
+    QStringList files;
+    if (fileInfo.isDir()) {
+        source->folder = fileInfo.absoluteFilePath();
+        files = folderFiles(source->folder);
+    } else if (extractor.open(fileInfo.absoluteFilePath())) {
+        QObject::connect(&extractor, &Extractor::finishedMemory, &extractor, [source, &files](const QStringList &entries, KArchive *archive) {
+            files = entries;
+            source->archive.reset(archive);
+        });
+        extractor.extractArchive();
+        if (source->archive == nullptr) {
+            return false;
+        }
+    } else if (extractor.isRar()) {
+        const QString unrar = QStandardPaths::findExecutable(u"unrar"_s);
+        source->extractionFolder = std::make_unique<QTemporaryDir>();
+        if (unrar.isEmpty() || !source->extractionFolder->isValid()) {
+            return false;
+        }
+        QProcess process;
+        process.start(unrar, {u"x"_s, u"-inul"_s, fileInfo.absoluteFilePath(), source->extractionFolder->path() + u"/"_s});
+        if (!process.waitForFinished(-1) || process.exitCode() != 0) {
+            return false;
+        }
+        source->folder = source->extractionFolder->path();
+        files = folderFiles(source->folder);
+    } else {
+        return false;
+    }
+
+    // drops __MACOSX and other non image files
+    source->pages = extractor.filterImages(files);
+    QCollator collator;
+    collator.setNumericMode(true);
+    std::sort(source->pages.begin(), source->pages.end(), collator);
+
+    return !source->pages.isEmpty();
+}
+
+QByteArray readSourcePage(const Source &source, const QString &page)
+{
+    if (source.archive != nullptr) {
+        const KArchiveFile *file = source.archive->directory()->file(page);
+        return file != nullptr ? file->data() : QByteArray();
+    }
+    QFile file(source.folder + u"/"_s + page);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+bool isGrayscale(const QImage &image)
+{
+    if (image.format() == QImage::Format_Grayscale8 || image.format() == QImage::Format_Grayscale16) {
+        return true;
+    }
+    if (image.hasAlphaChannel()) {
+        return false;
+    }
+
+    const QImage rgb = image.convertToFormat(QImage::Format_RGB32);
+    for (int y = 0; y < rgb.height(); ++y) {
+        const auto *line = reinterpret_cast<const QRgb *>(rgb.constScanLine(y));
+        for (int x = 0; x < rgb.width(); ++x) {
+            const int green = qGreen(line[x]);
+            if (std::abs(qRed(line[x]) - green) > GRAYSCALE_TOLERANCE || std::abs(qBlue(line[x]) - green) > GRAYSCALE_TOLERANCE) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+} // namespace
+
+int Repacker::run(const QStringList &volumes, const QString &outputFolder)
+{
+    if (volumes.isEmpty()) {
+        qWarning() << "repack: no volumes given";
+        return 1;
+    }
+    if (!QDir().mkpath(outputFolder)) {
+        qWarning() << "repack: could not create" << outputFolder;
+        return 1;
+    }
+
+    // each volume is repacked on its own thread, pages have to be written in order anyway
+    QThreadPool pool;
+    std::atomic<int> failed{0};
+    // volumes with the same name, from different folders or with different extensions, get numbered
+    QSet<QString> outputs;
+    for (const QString &volume : volumes) {
+        const QFileInfo volumeInfo(volume);
+        const QString name = volumeInfo.isDir() ? volumeInfo.fileName() : volumeInfo.completeBaseName();
+        QString output = QDir(outputFolder).absoluteFilePath(name + u".cbz"_s);
+        // repacking a cbz in its own folder, the default, must not write over it
+        for (int number = 2; outputs.contains(output) || output == volumeInfo.absoluteFilePath(); ++number) {
+            output = QDir(outputFolder).absoluteFilePath(u"%1 (%2).cbz"_s.arg(name).arg(number));
+        }
+        outputs.insert(output);
+        if (QFileInfo::exists(output)) {
+            qWarning() << "repack: skipping" << volume << "," << output << "already exists";
+            ++failed;
+            continue;
+        }
+        pool.start([volume, output, &failed]() {
+            if (!repack(volume, output)) {
+                ++failed;
+            }
+        });
+    }
+    pool.waitForDone();
+
+    return failed > 0 ? 1 : 0;
+}
+
+bool Repacker::repack(const QString &volume, const QString &output)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    Source source;
+    if (!openSource(volume, &source)) {
+        qWarning() << "repack: could not open" << volume;
+        return false;
+    }
+
+    // written under a temporary name, an interrupted repack must not leave a cbz that later runs skip
+    const QFileInfo outputInfo(output);
+    const QString partialOutput = outputInfo.absolutePath() + u"/."_s + outputInfo.fileName() + u".part"_s;
+    KZip zip(partialOutput);
+    zip.setCompression(KZip::NoCompression);
+    zip.setExtraField(KZip::NoExtraField);
+    if (!zip.open(QIODevice::WriteOnly)) {
+        qWarning() << "repack: could not write" << partialOutput << zip.errorString();
+        return false;
+    }
+
+    // renamed so that the stored order and the natural order are the same
+    const int digits = std::max<int>(3, QString::number(source.pages.count()).size());
+    QList<RepackIndex::Page> pages;
+    qint64 offset = 0;
+    bool ok = true;
+    for (const QString &sourcePage : std::as_const(source.pages)) {
+        QByteArray data = readSourcePage(source, sourcePage);
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader imageReader(&buffer);
+        imageReader.setAutoTransform(true);
+        const QImage image = imageReader.read();
+        if (image.isNull()) {
+            qWarning() << "repack: skipping" << sourcePage << "in" << volume << imageReader.errorString();
+            continue;
+        }
+
+        RepackIndex::Page page;
+        page.name = u"%1.%2"_s.arg(pages.count() + 1, digits, 10, u'0').arg(QFileInfo(sourcePage).suffix().toLower());
+        page.size = image.size();
+        page.grayscale = isGrayscale(image);
+        // stored entries are the local header, the name and the data, without extra field
+        page.offset = offset + LOCAL_HEADER_SIZE + page.name.toUtf8().size();
+        page.length = data.size();
+        if (!zip.writeFile(page.name, data)) {
+            ok = false;
+            break;
+        }
+        offset = page.offset + page.length;
+        pages.append(page);
+    }
+
+    ok = ok && !pages.isEmpty() && zip.writeFile(QString::fromLatin1(RepackIndex::FILE_NAME), RepackIndex::serialize(pages));
+    ok = zip.close() && ok;
+    // the offsets in the index have to match what was actually written
+    if (!ok || RepackIndex::read(partialOutput).size() != pages.size() || !QFile::rename(partialOutput, output)) {
+        qWarning() << "repack: failed to write" << output << zip.errorString();
+        QFile::remove(partialOutput);
+        return false;
+    }
+
+    qInfo() << "repack:" << volume << "->" << output << pages.count() << "pages in" << timer.elapsed() << "ms";
+    return true;
+}
@@ -0,0 +1,30 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef REPACKER_H
+#define REPACKER_H
+
+#include <QStringList>
+
+/*
+ * Batch mode started with `rakki --repack`, converts volumes (folders and any
+ * supported archive) into cbz files optimized for reading: pages stored
+ * uncompressed in reading order, without junk files and with an index, see RepackIndex
+ */
+class Repacker
+{
+public:
+    /*
+     * Repacks the volumes into `outputFolder`, several volumes at once.
+     * Returns the exit code of the process
+     */
+    static int run(const QStringList &volumes, const QString &outputFolder);
+
+private:
+    static bool repack(const QString &volume, const QString &output);
+};
+
+#endif // REPACKER_H
@@ -0,0 +1,158 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "repackindex.h"
+
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtEndian>
+
+using namespace Qt::StringLiterals;
+
+namespace
+{
+constexpr int VERSION = 1;
+constexpr qint64 END_OF_CENTRAL_DIRECTORY_SIZE = 22;
+constexpr qint64 CENTRAL_DIRECTORY_RECORD_SIZE = 46;
+constexpr qint64 LOCAL_HEADER_SIZE = 30;
+// a volume has a few thousand pages at most
+constexpr qint64 MAXIMUM_CENTRAL_DIRECTORY_SIZE = 16 * 1024 * 1024;
+constexpr qint64 MAXIMUM_INDEX_SIZE = 16 * 1024 * 1024;
+
+struct CentralDirectoryEntry {
+    quint32 crc32{0};
+    qint64 compressedSize{0};
+    // where the data starts if the local header has no extra field, which is the case for repacked files
+    qint64 dataOffset{0};
+    bool stored{false};
+};
+} // namespace
+
+QByteArray RepackIndex::serialize(const QList<Page> &pages)
+{
+    QJsonArray pageArray;
+    for (const Page &page : pages) {
+        pageArray.append(QJsonObject{
+            {u"name"_s, page.name},
+            {u"width"_s, page.size.width()},
+            {u"height"_s, page.size.height()},
+            {u"grayscale"_s, page.grayscale},
+            {u"offset"_s, page.offset},
+            {u"length"_s, page.length},
+        });
+    }
+    const QJsonObject index{{u"version"_s, VERSION}, {u"pages"_s, pageArray}};
+    return QJsonDocument(index).toJson(QJsonDocument::Compact);
+}
+
+QList<RepackIndex::Page> RepackIndex::read(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < END_OF_CENTRAL_DIRECTORY_SIZE) {
+        return {};
+    }
+
+    // repacked files have no archive comment, so the end of central directory record is at the very end
+    file.seek(file.size() - END_OF_CENTRAL_DIRECTORY_SIZE);
+    const QByteArray end = file.read(END_OF_CENTRAL_DIRECTORY_SIZE);
+    if (end.size() != END_OF_CENTRAL_DIRECTORY_SIZE || !end.startsWith("PK\x05\x06")) {
+        return {};
+    }
+    const auto *e = reinterpret_cast<const uchar *>(end.constData());
+    const qint64 directorySize = qFromLittleEndian<quint32>(e + 12);
+    const qint64 directoryOffset = qFromLittleEndian<quint32>(e + 16);
+    if (directorySize > MAXIMUM_CENTRAL_DIRECTORY_SIZE || directoryOffset + directorySize > file.size() - END_OF_CENTRAL_DIRECTORY_SIZE) {
+        return {};
+    }
+
+    file.seek(directoryOffset);
+    const QByteArray directory = file.read(directorySize);
+    if (directory.size() != directorySize) {
+        return {};
+    }
+    const auto *d = reinterpret_cast<const uchar *>(directory.constData());
+    QHash<QString, CentralDirectoryEntry> entries;
+    QString lastName;
+    for (qint64 pos = 0; pos + CENTRAL_DIRECTORY_RECORD_SIZE <= directorySize;) {
+        if (qFromLittleEndian<quint32>(d + pos) != 0x02014b50) {
+            return {};
+        }
+        const qint64 nameLength = qFromLittleEndian<quint16>(d + pos + 28);
+        const qint64 recordSize = CENTRAL_DIRECTORY_RECORD_SIZE + nameLength + qFromLittleEndian<quint16>(d + pos + 30) + qFromLittleEndian<quint16>(d + pos + 32);
+        if (pos + recordSize > directorySize) {
+            return {};
+        }
+
+        CentralDirectoryEntry entry;
+        entry.stored = qFromLittleEndian<quint16>(d + pos + 10) == 0;
+        entry.crc32 = qFromLittleEndian<quint32>(d + pos + 16);
+        entry.compressedSize = qFromLittleEndian<quint32>(d + pos + 20);
+        entry.dataOffset = qint64(qFromLittleEndian<quint32>(d + pos + 42)) + LOCAL_HEADER_SIZE + nameLength;
+        lastName = QString::fromUtf8(directory.mid(pos + CENTRAL_DIRECTORY_RECORD_SIZE, nameLength));
+        entries.insert(lastName, entry);
+        pos += recordSize;
+    }
+
+    // the index is written last
+    const CentralDirectoryEntry indexEntry = entries.value(lastName);
+    if (lastName != QLatin1StringView(FILE_NAME) || !indexEntry.stored || indexEntry.compressedSize > MAXIMUM_INDEX_SIZE) {
+        return {};
+    }
+    file.seek(indexEntry.dataOffset - LOCAL_HEADER_SIZE - lastName.toUtf8().size());
+    const QByteArray localHeader = file.read(LOCAL_HEADER_SIZE);
+    if (localHeader.size() != LOCAL_HEADER_SIZE || !localHeader.startsWith("PK\x03\x04")
+        || qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(localHeader.constData()) + 28) != 0) {
+        return {};
+    }
+    file.seek(indexEntry.dataOffset);
+    const QJsonObject index = QJsonDocument::fromJson(file.read(indexEntry.compressedSize)).object();
+    if (index.value(u"version"_s).toInt() != VERSION) {
+        return {};
+    }
+
+    // the index has to match the archive, it could have been modified by another program
+    QList<Page> pages;
+    const QJsonArray pageArray = index.value(u"pages"_s).toArray();
+    pages.reserve(pageArray.size());
+    for (const auto &value : pageArray) {
+        const QJsonObject object = value.toObject();
+        Page page;
+        page.name = object.value(u"name"_s).toString();
+        page.size = QSize(object.value(u"width"_s).toInt(), object.value(u"height"_s).toInt());
+        page.grayscale = object.value(u"grayscale"_s).toBool();
+        page.offset = object.value(u"offset"_s).toInteger();
+        page.length = object.value(u"length"_s).toInteger();
+
+        const auto it = entries.constFind(page.name);
+        if (it == entries.constEnd() || !it->stored || it->dataOffset != page.offset || it->compressedSize != page.length || page.size.isEmpty()) {
+            return {};
+        }
+        page.crc32 = it->crc32;
+        pages.append(page);
+    }
+
+    return pages;
+}
+
+PooledBuffer RepackIndex::readPage(const QString &path, const Page &page)
+{
+    QFile file(path);
+    if (page.length <= 0 || !file.open(QIODevice::ReadOnly) || !file.seek(page.offset)) {
+        return PooledBuffer();
+    }
+
+    // stored uncompressed, a single read straight into the buffer
+    PooledBuffer buffer(page.length);
+    const qint64 bytesRead = file.read(buffer.data(), page.length);
+    if (bytesRead != page.length) {
+        return PooledBuffer();
+    }
+
+    return buffer;
+}
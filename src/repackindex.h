@@ -0,0 +1,46 @@
+/*
+ * SPDX-FileCopyrightText: 2024 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef REPACKINDEX_H
+#define REPACKINDEX_H
+
+#include <QByteArray>
+#include <QList>
+#include <QSize>
+#include <QString>
+
+#include "bufferpool.h"
+
+/*
+ * Index stored as the last entry of the cbz files written by `rakki --repack`.
+ * The pages of those files are stored uncompressed in reading order, the index
+ * lists them with their size and position so opening the volume doesn't have
+ * to list, sort and probe the entries.
+ */
+namespace RepackIndex
+{
+inline constexpr char FILE_NAME[] = "rakki-index.json";
+
+struct Page {
+    QString name;
+    QSize size;
+    bool grayscale{false};
+    // position of the page data in the cbz file
+    qint64 offset{0};
+    qint64 length{0};
+    // read from the zip central directory, not stored in the index
+    quint32 crc32{0};
+};
+
+QByteArray serialize(const QList<Page> &pages);
+/*
+ * Returns the pages of a repacked cbz file, or an empty list for any other file
+ */
+QList<Page> read(const QString &path);
+PooledBuffer readPage(const QString &path, const Page &page);
+}
+
+#endif // REPACKINDEX_H